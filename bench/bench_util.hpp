@@ -0,0 +1,155 @@
+/*
+ * Copyright 2017 Yamana Laboratory, Waseda University
+ * Supported by JST CREST Grant Number JPMJCR1503, Japan.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//  common helpers of benchmarks
+//  each benchmark prints a `RESULT` line, which run_bench.sh collects
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <vector>
+#include <x86intrin.h>
+
+namespace bench {
+
+    //  ns per TSC tick, measured once
+    inline double nsPerCycle()
+    {
+        static double ratio = 0.0;
+        if (ratio == 0.0) {
+            auto t0 = std::chrono::steady_clock::now();
+            auto c0 = __rdtsc();
+            usleep(50000);
+            auto t1 = std::chrono::steady_clock::now();
+            auto c1 = __rdtsc();
+            ratio = std::chrono::duration<double, std::nano>(t1 - t0).count() / (c1 - c0);
+        }
+        return ratio;
+    }
+
+    inline double now()
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    //  peak RSS in KB
+    inline long peakRss()
+    {
+        char buf[4096];
+        auto fd = open("/proc/self/status", O_RDONLY);
+        if (fd == -1) {
+            return -1;
+        }
+        auto len = read(fd, buf, sizeof(buf) - 1);
+        close(fd);
+        if (len <= 0) {
+            return -1;
+        }
+        buf[len] = '\0';
+        auto p = strstr(buf, "VmHWM:");
+        return (p == nullptr) ? -1 : atol(p + 6);
+    }
+
+    //  latency samples of one thread, every `interval`-th call is kept
+    //  NOTE the buffer is allocated before the measurement
+    class Latency {
+        public:
+            explicit Latency(size_t capacity = 1 << 20, unsigned interval = 16)
+                : interval_(interval), cnt_(0)
+            {
+                samples_.reserve(capacity);
+            }
+
+            bool Sampling()
+            {
+                return (++cnt_ % interval_ == 0) && samples_.size() < samples_.capacity();
+            }
+            void Add(uint64_t cycles) { samples_.push_back(cycles); }
+
+            void Merge(const Latency& l)
+            {
+                samples_.insert(samples_.end(), l.samples_.begin(), l.samples_.end());
+            }
+
+            //  q in [0, 1], returns ns
+            double Percentile(double q)
+            {
+                if (samples_.empty()) {
+                    return 0.0;
+                }
+                auto k = (size_t)(q * (samples_.size() - 1));
+                std::nth_element(samples_.begin(), samples_.begin() + k, samples_.end());
+                return samples_[k] * nsPerCycle();
+            }
+
+        private:
+            unsigned interval_;
+            unsigned cnt_;
+            std::vector<uint64_t> samples_;
+    };
+
+    //  time f() into l if the call is sampled
+    template <typename F>
+    inline void timed(Latency& l, F f)
+    {
+        if (!l.Sampling()) {
+            f();
+            return;
+        }
+        auto c0 = __rdtsc();
+        f();
+        l.Add(__rdtsc() - c0);
+    }
+
+    inline void report(const char *name, size_t ops, double sec, Latency& l)
+    {
+        printf("RESULT %s ops_per_sec=%.0f p50_ns=%.1f p99_ns=%.1f peak_rss_kb=%ld\n",
+                name, ops / sec, l.Percentile(0.5), l.Percentile(0.99), peakRss());
+    }
+
+    //  xorshift, which never calls malloc unlike <random> of some libraries
+    struct Rand {
+        uint64_t s;
+        explicit Rand(uint64_t seed) : s(seed * 0x9e3779b97f4a7c15ull | 1) {}
+        uint64_t operator()()
+        {
+            s ^= s << 13;
+            s ^= s >> 7;
+            s ^= s << 17;
+            return s;
+        }
+    };
+
+    inline int arg(int argc, char **argv, int i, int value)
+    {
+        return (argc > i) ? atoi(argv[i]) : value;
+    }
+
+    inline int numThreads(int argc, char **argv, int i)
+    {
+        auto n = arg(argc, argv, i, 0);
+        return (n > 0) ? n : std::max(2l, sysconf(_SC_NPROCESSORS_ONLN));
+    }
+
+} // namespace bench
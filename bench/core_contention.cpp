@@ -0,0 +1,92 @@
+/*
+ * Copyright 2017 Yamana Laboratory, Waseda University
+ * Supported by JST CREST Grant Number JPMJCR1503, Japan.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//  contention of per-core records of the common memory pool, linked directly
+//  each thread is pinned to its own CPU and returns/refills chunks of its own core,
+//  so no lock is shared and any slowdown with more threads comes from shared lines
+//  core_contention_packed is built with FCM_CACHE_LINE_SIZE=8 for comparison
+//  usage: core_contention [#threads] [#round trips per thread]
+
+#include "src/common_memory_pool.hpp"
+#include "src/memory_linked_list_manager.hpp"
+#include "src/memory_size_manager.hpp"
+#include "src/mmap_manager.hpp"
+
+#include "bench_util.hpp"
+
+#include <pthread.h>
+#include <sched.h>
+#include <thread>
+
+//  NOTE defined in fcmalloc.cpp, which is not linked
+MmapManager mm;
+thread_local bool mainThreadFlag = false;
+
+namespace {
+    const int INDEX = 6;
+    const size_t BATCH = 8;
+
+    void worker(CommonMemoryPool& cmp, int ncores, int core, int nops, bench::Latency& l)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(core % sysconf(_SC_NPROCESSORS_ONLN), &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+
+        MemoryLinkedListManager list;
+        list.Init(ncores);
+        list.Allocate(core, (size_t)1 << INDEX, BATCH);
+        for (auto op = 0; op < nops; ++op) {
+            bench::timed(l, [&] {
+                cmp.Free(&list, core);
+                auto p = cmp.Malloc(&list, core, (size_t)1 << INDEX);
+                list.push(INDEX, (MemoryLinkedList *)((uintptr_t)p - sizeof(MemoryLinkedList)));
+            });
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    auto nthreads = bench::numThreads(argc, argv, 1);
+    auto nops = bench::arg(argc, argv, 2, 1000000);
+
+    mm.Init(nthreads, sysconf(_SC_PAGESIZE), 16ul << 20, 16ul << 20);
+    MemorySizeManager msm;
+    msm.SetMemorySize(INDEX, BATCH);
+    CommonMemoryPool cmp;
+    cmp.Init(nthreads, msm);
+
+    std::vector<bench::Latency> ls(nthreads);
+    std::vector<std::thread> threads;
+    auto t0 = bench::now();
+    for (auto i = 0; i < nthreads; ++i) {
+        threads.emplace_back(worker, std::ref(cmp), nthreads, i, nops, std::ref(ls[i]));
+    }
+    for (auto& th : threads) {
+        th.join();
+    }
+    auto sec = bench::now() - t0;
+    for (auto i = 1; i < nthreads; ++i) {
+        ls[0].Merge(ls[i]);
+    }
+
+    char name[64];
+    snprintf(name, sizeof(name), "core_contention/line%d", FCM_CACHE_LINE_SIZE);
+    bench::report(name, (size_t)nops * nthreads, sec, ls[0]);
+    return 0;
+}
@@ -0,0 +1,222 @@
+/*
+ * Copyright 2017 Yamana Laboratory, Waseda University
+ * Supported by JST CREST Grant Number JPMJCR1503, Japan.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//  synthetic workload shaped like HElib, without HElib
+//  a DoubleCRT is a limb of ring dimension length per prime, and a ciphertext is two of them.
+//  limbs are allocated and freed by different OpenMP threads, and key switching
+//  allocates large temporaries, as HElib does.
+//  usage: fhe_workload [log2 ring dimension] [#primes] [#threads] [#ciphertexts] [#iterations]
+
+#include "bench_util.hpp"
+
+#include <omp.h>
+
+namespace {
+    const uint64_t P = (1ull << 50) - 27;  // a prime, only used to make work
+    const int DIGITS = 3;                  // #digits of key switching
+    const int SPECIAL_PRIMES = 4;
+
+    struct DoubleCRT {
+        std::vector<uint64_t *> limbs;
+    };
+    struct Ciphertext {
+        DoubleCRT parts[2];
+    };
+
+    size_t ringDim;
+    size_t mallocCnt;
+
+    uint64_t *newLimb()
+    {
+        auto p = (uint64_t *)malloc(ringDim * sizeof(uint64_t));
+        __atomic_add_fetch(&mallocCnt, 1, __ATOMIC_RELAXED);
+        return p;
+    }
+
+    //  limbs are allocated in parallel, so each prime may belong to a different thread
+    void alloc(DoubleCRT& d, int nprimes, uint64_t seed)
+    {
+        d.limbs.resize(nprimes);
+#pragma omp parallel for schedule(dynamic)
+        for (auto i = 0; i < nprimes; ++i) {
+            auto l = newLimb();
+            for (size_t j = 0; j < ringDim; ++j) {
+                l[j] = (seed + i * ringDim + j) % P;
+            }
+            d.limbs[i] = l;
+        }
+    }
+
+    //  freed in the reverse order with dynamic schedule, so mostly by another thread
+    void release(DoubleCRT& d)
+    {
+        auto n = (int)d.limbs.size();
+#pragma omp parallel for schedule(dynamic)
+        for (auto i = n - 1; i >= 0; --i) {
+            free(d.limbs[i]);
+        }
+        d.limbs.clear();
+    }
+
+    void mulLimb(uint64_t *dst, const uint64_t *a, const uint64_t *b)
+    {
+        for (size_t j = 0; j < ringDim; ++j) {
+            dst[j] = (uint64_t)(((unsigned __int128)a[j] * b[j]) % P);
+        }
+    }
+
+    //  tensor product of two ciphertexts, and key switching of the third part
+    void multiply(Ciphertext& c, const Ciphertext& a, const Ciphertext& b)
+    {
+        auto nprimes = (int)a.parts[0].limbs.size();
+        DoubleCRT d2;
+        d2.limbs.resize(nprimes);
+        for (auto k = 0; k < 2; ++k) {
+            c.parts[k].limbs.resize(nprimes);
+        }
+#pragma omp parallel for schedule(dynamic)
+        for (auto i = 0; i < nprimes; ++i) {
+            c.parts[0].limbs[i] = newLimb();
+            c.parts[1].limbs[i] = newLimb();
+            d2.limbs[i] = newLimb();
+            mulLimb(c.parts[0].limbs[i], a.parts[0].limbs[i], b.parts[0].limbs[i]);
+            mulLimb(c.parts[1].limbs[i], a.parts[0].limbs[i], b.parts[1].limbs[i]);
+            mulLimb(d2.limbs[i], a.parts[1].limbs[i], b.parts[1].limbs[i]);
+        }
+
+        //  key switching: d2 is split into digits, and each digit is raised to
+        //  all primes and special primes, which are large temporaries
+        auto nraised = nprimes + SPECIAL_PRIMES;
+#pragma omp parallel for schedule(dynamic)
+        for (auto t = 0; t < DIGITS * nraised; ++t) {
+            auto tmp = (uint64_t *)malloc(2 * ringDim * sizeof(uint64_t));
+            __atomic_add_fetch(&mallocCnt, 1, __ATOMIC_RELAXED);
+            auto src = d2.limbs[t % nprimes];
+            for (size_t j = 0; j < ringDim; ++j) {
+                tmp[j] = src[j];
+                tmp[ringDim + j] = src[j] ^ t;
+            }
+            auto i = t % nprimes;
+            //  NOTE accumulation into c is racy on purpose, values do not matter
+            c.parts[0].limbs[i][t % ringDim] += tmp[ringDim - 1];
+            free(tmp);
+        }
+        release(d2);
+    }
+
+    //  drop the last prime
+    void modDown(Ciphertext& c)
+    {
+        for (auto& d : c.parts) {
+            if (d.limbs.size() > 1) {
+                free(d.limbs.back());
+                d.limbs.pop_back();
+            }
+        }
+    }
+
+    long currentRss()
+    {
+        char buf[4096];
+        auto fd = open("/proc/self/status", O_RDONLY);
+        if (fd == -1) {
+            return -1;
+        }
+        auto len = read(fd, buf, sizeof(buf) - 1);
+        close(fd);
+        if (len <= 0) {
+            return -1;
+        }
+        buf[len] = '\0';
+        auto p = strstr(buf, "VmRSS:");
+        return (p == nullptr) ? -1 : atol(p + 6);
+    }
+
+    struct Phase {
+        const char *name;
+        double t0;
+        size_t cnt0;
+
+        explicit Phase(const char *n) : name(n), t0(omp_get_wtime()), cnt0(mallocCnt) {}
+        ~Phase()
+        {
+            auto sec = omp_get_wtime() - t0;
+            auto cnt = mallocCnt - cnt0;
+            printf("RESULT fhe/%s sec=%.3f mallocs=%zu mallocs_per_sec=%.0f rss_kb=%ld peak_rss_kb=%ld\n",
+                    name, sec, cnt, cnt / sec, currentRss(), bench::peakRss());
+        }
+    };
+}
+
+int main(int argc, char **argv)
+{
+    auto logN = bench::arg(argc, argv, 1, 14);
+    auto nprimes = bench::arg(argc, argv, 2, 20);
+    auto nthreads = bench::numThreads(argc, argv, 3);
+    auto nctxts = bench::arg(argc, argv, 4, 8);
+    auto iterations = bench::arg(argc, argv, 5, 4);
+    ringDim = (size_t)1 << logN;
+    omp_set_num_threads(nthreads);
+    printf("fhe_workload: ring dimension 2^%d, %d primes, %d threads, %d ciphertexts, %d iterations\n",
+            logN, nprimes, nthreads, nctxts, iterations);
+    printf("a ciphertext is %.1f MB\n", 2.0 * nprimes * ringDim * sizeof(uint64_t) / (1024 * 1024));
+    fflush(stdout);
+
+    std::vector<Ciphertext> ctxts(nctxts);
+    {
+        Phase p("encrypt");
+        for (auto i = 0; i < nctxts; ++i) {
+            alloc(ctxts[i].parts[0], nprimes, 2 * i);
+            alloc(ctxts[i].parts[1], nprimes, 2 * i + 1);
+        }
+    }
+    for (auto it = 0; it < iterations; ++it) {
+        std::vector<Ciphertext> products(nctxts / 2);
+        {
+            Phase p("multiply");
+            for (auto i = 0; i < nctxts / 2; ++i) {
+                multiply(products[i], ctxts[2 * i], ctxts[2 * i + 1]);
+            }
+        }
+        {
+            Phase p("moddown");
+            for (auto& c : products) {
+                modDown(c);
+            }
+        }
+        {
+            //  replace the inputs by the products, as a circuit goes deeper
+            Phase p("replace");
+            for (auto i = 0; i < nctxts / 2; ++i) {
+                for (auto k = 0; k < 2; ++k) {
+                    release(ctxts[2 * i].parts[k]);
+                    ctxts[2 * i].parts[k].limbs = products[i].parts[k].limbs;
+                    release(ctxts[2 * i + 1].parts[k]);
+                    alloc(ctxts[2 * i + 1].parts[k], products[i].parts[k].limbs.size(), it);
+                }
+            }
+        }
+    }
+    {
+        Phase p("teardown");
+        for (auto& c : ctxts) {
+            release(c.parts[0]);
+            release(c.parts[1]);
+        }
+    }
+    return 0;
+}
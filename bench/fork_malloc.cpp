@@ -0,0 +1,103 @@
+/*
+ * Copyright 2017 Yamana Laboratory, Waseda University
+ * Supported by JST CREST Grant Number JPMJCR1503, Japan.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//  fork_malloc: fork while other threads malloc/free, and the child mallocs at once
+//  it measures fork + child + wait, which includes the pthread_atfork handlers
+//  usage: fork_malloc [#threads] [#fork] [#malloc per child]
+
+#include "bench_util.hpp"
+
+#include <atomic>
+#include <signal.h>
+#include <sys/wait.h>
+#include <thread>
+
+namespace {
+    std::atomic<bool> done(false);
+
+    void churn(uint64_t seed)
+    {
+        bench::Rand rnd(seed);
+        std::vector<void *> ptrs(1024, nullptr);
+        while (!done.load(std::memory_order_relaxed)) {
+            auto& p = ptrs[rnd() % ptrs.size()];
+            free(p);
+            p = malloc(16 + rnd() % 8192);
+        }
+        for (auto p : ptrs) {
+            free(p);
+        }
+    }
+
+    //  NOTE a deadlocked child is killed by alarm, and counted as failure
+    void child(int n)
+    {
+        alarm(10);
+        bench::Rand rnd(getpid());
+        std::vector<void *> ptrs(n);
+        for (auto i = 0; i < n; ++i) {
+            ptrs[i] = malloc(16 + rnd() % 65536);
+            if (ptrs[i] == nullptr) {
+                _exit(1);
+            }
+            memset(ptrs[i], 1, 16);
+        }
+        for (auto p : ptrs) {
+            free(p);
+        }
+        _exit(0);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    auto nthreads = bench::numThreads(argc, argv, 1);
+    auto nforks = bench::arg(argc, argv, 2, 1000);
+    auto n = bench::arg(argc, argv, 3, 1000);
+    printf("fork_malloc: %d threads, %d forks x %d mallocs\n", nthreads, nforks, n);
+    fflush(stdout);
+
+    std::vector<std::thread> threads;
+    for (auto i = 1; i < nthreads; ++i) {
+        threads.emplace_back(churn, i);
+    }
+    bench::Latency lat(nforks, 1);
+    auto failed = 0;
+    auto t0 = bench::now();
+    for (auto i = 0; i < nforks; ++i) {
+        bench::timed(lat, [&] {
+            auto pid = fork();
+            if (pid == 0) {
+                child(n);
+            }
+            int status = 0;
+            if (pid == -1 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+                ++failed;
+            }
+        });
+    }
+    auto t1 = bench::now();
+    done = true;
+    for (auto& th : threads) {
+        th.join();
+    }
+    if (failed > 0) {
+        printf("fork_malloc: %d children failed\n", failed);
+    }
+    bench::report("fork_malloc", nforks, t1 - t0, lat);
+    return (failed > 0) ? 1 : 0;
+}
@@ -0,0 +1,82 @@
+/*
+ * Copyright 2017 Yamana Laboratory, Waseda University
+ * Supported by JST CREST Grant Number JPMJCR1503, Japan.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//  larson: each thread replaces random chunks of its array, and then hands
+//  the array to a new thread, so chunks are freed by threads other than their owner
+//  usage: larson [#threads] [#rounds] [#replace per round] [#chunks per thread]
+
+#include "bench_util.hpp"
+
+#include <thread>
+
+namespace {
+    const size_t CHUNK_MIN = 16;
+    const size_t CHUNK_MAX = 1024;
+
+    void replace(std::vector<void *>& chunks, int n, uint64_t seed, bench::Latency& lat)
+    {
+        bench::Rand rnd(seed);
+        for (auto i = 0; i < n; ++i) {
+            auto k = rnd() % chunks.size();
+            size_t size = CHUNK_MIN + rnd() % (CHUNK_MAX - CHUNK_MIN);
+            bench::timed(lat, [&] { free(chunks[k]); });
+            bench::timed(lat, [&] { chunks[k] = malloc(size); });
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    auto nthreads = bench::numThreads(argc, argv, 1);
+    auto rounds = bench::arg(argc, argv, 2, 10);
+    auto n = bench::arg(argc, argv, 3, 100000);
+    auto nchunks = bench::arg(argc, argv, 4, 1000);
+    printf("larson: %d threads, %d rounds x %d, %d chunks\n", nthreads, rounds, n, nchunks);
+    fflush(stdout);
+
+    std::vector<std::vector<void *>> arrays(nthreads, std::vector<void *>(nchunks));
+    bench::Rand rnd(1);
+    for (auto& a : arrays) {
+        for (auto& p : a) {
+            p = malloc(CHUNK_MIN + rnd() % (CHUNK_MAX - CHUNK_MIN));
+        }
+    }
+    std::vector<bench::Latency> lats(nthreads);
+
+    auto t0 = bench::now();
+    for (auto r = 0; r < rounds; ++r) {
+        std::vector<std::thread> threads;
+        for (auto i = 0; i < nthreads; ++i) {
+            threads.emplace_back(replace, std::ref(arrays[i]), n, r * nthreads + i + 1, std::ref(lats[i]));
+        }
+        for (auto& th : threads) {
+            th.join();
+        }
+    }
+    auto t1 = bench::now();
+
+    for (auto& a : arrays) {
+        for (auto p : a) {
+            free(p);
+        }
+    }
+    for (auto i = 1; i < nthreads; ++i) {
+        lats[0].Merge(lats[i]);
+    }
+    bench::report("larson", 2 * (size_t)nthreads * rounds * n, t1 - t0, lats[0]);
+    return 0;
+}
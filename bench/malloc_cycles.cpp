@@ -0,0 +1,80 @@
+/*
+ * Copyright 2017 Yamana Laboratory, Waseda University
+ * Supported by JST CREST Grant Number JPMJCR1503, Japan.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//  cycles per malloc and per free on the steady-state fast path
+//  usage: malloc_cycles [#calls per round] [#rounds]
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <x86intrin.h>
+
+#ifdef FCM_INLINE
+//  fast paths of libfcmalloc.a inlined
+#include "src/fcmalloc_inline.hpp"
+#define MALLOC fcmalloc::Malloc
+#define FREE fcmalloc::Free
+#else
+#define MALLOC malloc
+#define FREE free
+#endif
+
+namespace {
+    const size_t sizes[] = { 16, 64, 256, 1024, 4096, 16384 };
+
+    //  avoid that the compiler removes malloc/free pairs
+    void *volatile sink;
+}
+
+int main(int argc, char **argv)
+{
+    auto n = (argc > 1) ? atoi(argv[1]) : 512;
+    auto rounds = (argc > 2) ? atoi(argv[2]) : 2000;
+
+    auto ptrs = (void **)malloc(n * sizeof(void *));
+    printf("%8s %16s %16s\n", "size", "malloc[cycles]", "free[cycles]");
+    for (auto size : sizes) {
+        //  warm up so that every round hits the thread cache
+        for (auto i = 0; i < n; ++i) {
+            ptrs[i] = MALLOC(size);
+        }
+        for (auto i = 0; i < n; ++i) {
+            FREE(ptrs[i]);
+        }
+
+        uint64_t mallocCycles = 0;
+        uint64_t freeCycles = 0;
+        for (auto r = 0; r < rounds; ++r) {
+            auto t0 = __rdtsc();
+            for (auto i = 0; i < n; ++i) {
+                ptrs[i] = MALLOC(size);
+            }
+            auto t1 = __rdtsc();
+            sink = ptrs[n - 1];
+            for (auto i = n - 1; i >= 0; --i) {
+                FREE(ptrs[i]);
+            }
+            auto t2 = __rdtsc();
+            mallocCycles += t1 - t0;
+            freeCycles += t2 - t1;
+        }
+        auto calls = (double)n * rounds;
+        printf("%8zu %16.2f %16.2f\n", size, mallocCycles / calls, freeCycles / calls);
+    }
+    free(ptrs);
+    return 0;
+}
@@ -0,0 +1,91 @@
+/*
+ * Copyright 2017 Yamana Laboratory, Waseda University
+ * Supported by JST CREST Grant Number JPMJCR1503, Japan.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//  producer threads malloc and consumer threads free, so every free is remote
+//  usage: producer_consumer [#pairs] [#malloc per producer]
+
+#include "bench_util.hpp"
+
+#include <atomic>
+#include <thread>
+
+namespace {
+    const size_t QUEUE_N = 1 << 12;
+
+    struct Queue {
+        void *ptrs[QUEUE_N];
+        alignas(64) std::atomic<size_t> head{0};
+        alignas(64) std::atomic<size_t> tail{0};
+    };
+
+    void produce(Queue& q, int n, bench::Latency& lat)
+    {
+        bench::Rand rnd((uintptr_t)&q);
+        for (auto i = 0; i < n; ++i) {
+            size_t size = 16 << (rnd() % 9);
+            void *p;
+            bench::timed(lat, [&] { p = malloc(size); });
+            memset(p, 0, 16);
+            auto tail = q.tail.load(std::memory_order_relaxed);
+            while (tail - q.head.load(std::memory_order_acquire) >= QUEUE_N) {
+                std::this_thread::yield();
+            }
+            q.ptrs[tail % QUEUE_N] = p;
+            q.tail.store(tail + 1, std::memory_order_release);
+        }
+    }
+
+    void consume(Queue& q, int n, bench::Latency& lat)
+    {
+        for (auto i = 0; i < n; ++i) {
+            auto head = q.head.load(std::memory_order_relaxed);
+            while (q.tail.load(std::memory_order_acquire) == head) {
+                std::this_thread::yield();
+            }
+            auto p = q.ptrs[head % QUEUE_N];
+            q.head.store(head + 1, std::memory_order_release);
+            bench::timed(lat, [&] { free(p); });
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    auto pairs = bench::numThreads(argc, argv, 1) / 2;
+    pairs = std::max(pairs, 1);
+    auto n = bench::arg(argc, argv, 2, 1000000);
+    printf("producer_consumer: %d pairs x %d\n", pairs, n);
+    fflush(stdout);
+
+    std::vector<Queue> queues(pairs);
+    std::vector<bench::Latency> lats(2 * pairs);
+    std::vector<std::thread> threads;
+    auto t0 = bench::now();
+    for (auto i = 0; i < pairs; ++i) {
+        threads.emplace_back(produce, std::ref(queues[i]), n, std::ref(lats[2 * i]));
+        threads.emplace_back(consume, std::ref(queues[i]), n, std::ref(lats[2 * i + 1]));
+    }
+    for (auto& th : threads) {
+        th.join();
+    }
+    auto t1 = bench::now();
+    for (auto i = 1; i < 2 * pairs; ++i) {
+        lats[0].Merge(lats[i]);
+    }
+    bench::report("producer_consumer", 2 * (size_t)pairs * n, t1 - t0, lats[0]);
+    return 0;
+}
@@ -0,0 +1,47 @@
+/*
+ * Copyright 2017 Yamana Laboratory, Waseda University
+ * Supported by JST CREST Grant Number JPMJCR1503, Japan.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//  buffers grown by realloc step by step, like a vector appended without reserve
+//  usage: realloc_growth [#buffers] [step] [max size]
+
+#include "bench_util.hpp"
+
+int main(int argc, char **argv)
+{
+    auto nbufs = bench::arg(argc, argv, 1, 1000);
+    size_t step = bench::arg(argc, argv, 2, 256);
+    size_t maxSize = bench::arg(argc, argv, 3, 256 * 1024);
+    printf("realloc_growth: %d buffers, +%zuB up to %zuB\n", nbufs, step, maxSize);
+    fflush(stdout);
+
+    bench::Latency lat(1 << 22, 1);
+    size_t ops = 0;
+    auto t0 = bench::now();
+    for (auto b = 0; b < nbufs; ++b) {
+        char *p = nullptr;
+        for (size_t size = step; size <= maxSize; size += step) {
+            bench::timed(lat, [&] { p = (char *)realloc(p, size); });
+            p[size - 1] = 1;
+            ++ops;
+        }
+        free(p);
+        ++ops;
+    }
+    auto t1 = bench::now();
+    bench::report("realloc_growth", ops, t1 - t0, lat);
+    return 0;
+}
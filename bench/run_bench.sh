@@ -0,0 +1,46 @@
+#!/bin/sh
+# run every benchmark with glibc, fcmalloc, and jemalloc/tcmalloc if installed,
+# and print ops/sec, p50/p99 latency and peak RSS
+# usage: run_bench.sh [path to libfcmalloc.so] [#threads]
+#   run in the build directory of bench/, e.g. `cd build/bench && ./run_bench.sh`
+
+dir=$(cd "$(dirname "$0")" && pwd)
+fcmalloc=${1:-$dir/../libfcmalloc.so}
+threads=${2:-$(nproc)}
+
+find_lib() {
+    ldconfig -p 2>/dev/null | awk -v name="$1" '$1 == name { print $NF; exit }'
+}
+
+allocators="glibc="
+[ -f "$fcmalloc" ] && allocators="$allocators fcmalloc=$fcmalloc"
+for lib in libjemalloc.so.2 libtcmalloc_minimal.so.4 libtcmalloc.so.4; do
+    path=$(find_lib $lib)
+    [ -n "$path" ] && allocators="$allocators ${lib%%.so*}=$path"
+done
+
+# NOTE arguments are separated by `,`
+benches="size_classes producer_consumer:$threads larson:$threads threadtest:$threads shbench:$threads realloc_growth fork_malloc:$threads"
+[ -x "$dir/fhe_workload" ] && benches="$benches fhe_workload:14,20,$threads"
+
+printf "%-14s %-22s %14s %10s %10s %14s\n" allocator benchmark ops/sec p50[ns] p99[ns] peak_rss[KB]
+for a in $allocators; do
+    name=${a%%=*}
+    lib=${a#*=}
+    for b in $benches; do
+        bin=${b%%:*}
+        args=""
+        [ "$bin" != "$b" ] && args=$(echo "${b#*:}" | tr , ' ')
+        # NOTE fcmalloc has FCM_POOL_BUFFER_SIZE managers per core, so allow more threads per core
+        LD_PRELOAD=$lib FCM_POOL_BUFFER_SIZE=${FCM_POOL_BUFFER_SIZE:-16} "$dir/$bin" $args 2>/dev/null \
+            | awk -v a="$name" '/RESULT / {
+                # NOTE a line may follow a message without newline
+                sub(/.*RESULT /, "RESULT ")
+                split("", v)
+                v["p50_ns"] = v["p99_ns"] = "-"
+                for (i = 3; i <= NF; ++i) { split($i, kv, "="); v[kv[1]] = kv[2] }
+                ops = ("ops_per_sec" in v) ? v["ops_per_sec"] : v["mallocs_per_sec"]
+                printf "%-14s %-22s %14s %10s %10s %14s\n", a, $2, ops, v["p50_ns"], v["p99_ns"], v["peak_rss_kb"]
+            }'
+    done
+done
@@ -0,0 +1,78 @@
+/*
+ * Copyright 2017 Yamana Laboratory, Waseda University
+ * Supported by JST CREST Grant Number JPMJCR1503, Japan.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//  shbench style: mixed sizes, mostly small and sometimes large, freed in random order
+//  usage: shbench [#threads] [#malloc per thread] [#live chunks per thread]
+
+#include "bench_util.hpp"
+
+#include <thread>
+
+namespace {
+    //  3/4 are 8B-256B, and the rest are up to 64KB
+    size_t randomSize(bench::Rand& rnd)
+    {
+        auto r = rnd();
+        if (r % 4 != 0) {
+            return 8 + (r >> 8) % 248;
+        }
+        return 256 + (r >> 8) % (64 * 1024 - 256);
+    }
+
+    void run(int n, int live, uint64_t seed, bench::Latency& lat)
+    {
+        bench::Rand rnd(seed);
+        std::vector<void *> ptrs(live, nullptr);
+        for (auto i = 0; i < n; ++i) {
+            auto k = rnd() % live;
+            if (ptrs[k] != nullptr) {
+                bench::timed(lat, [&] { free(ptrs[k]); });
+            }
+            auto size = randomSize(rnd);
+            bench::timed(lat, [&] { ptrs[k] = malloc(size); });
+        }
+        for (auto p : ptrs) {
+            free(p);
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    auto nthreads = bench::numThreads(argc, argv, 1);
+    auto n = bench::arg(argc, argv, 2, 1000000);
+    auto live = bench::arg(argc, argv, 3, 1000);
+    printf("shbench: %d threads, %d malloc, %d live\n", nthreads, n, live);
+    fflush(stdout);
+
+    std::vector<bench::Latency> lats(nthreads);
+    std::vector<std::thread> threads;
+    auto t0 = bench::now();
+    for (auto i = 0; i < nthreads; ++i) {
+        threads.emplace_back(run, n, live, i + 1, std::ref(lats[i]));
+    }
+    for (auto& th : threads) {
+        th.join();
+    }
+    auto t1 = bench::now();
+    for (auto i = 1; i < nthreads; ++i) {
+        lats[0].Merge(lats[i]);
+    }
+    //  NOTE frees of the first round are not counted
+    bench::report("shbench", 2 * (size_t)nthreads * n, t1 - t0, lats[0]);
+    return 0;
+}
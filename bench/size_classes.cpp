@@ -0,0 +1,56 @@
+/*
+ * Copyright 2017 Yamana Laboratory, Waseda University
+ * Supported by JST CREST Grant Number JPMJCR1503, Japan.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//  single thread malloc/free latency per size class
+//  usage: size_classes [#calls per round] [#rounds]
+
+#include "bench_util.hpp"
+
+int main(int argc, char **argv)
+{
+    auto n = bench::arg(argc, argv, 1, 1024);
+    auto rounds = bench::arg(argc, argv, 2, 500);
+    printf("size_classes: %d calls x %d rounds\n", n, rounds);
+    fflush(stdout);
+
+    std::vector<void *> ptrs(n);
+    for (size_t size = 8; size <= 64 * 1024; size *= 2) {
+        bench::Latency lat(2 * (size_t)n * rounds, 1);
+        //  warm up
+        for (auto i = 0; i < n; ++i) {
+            ptrs[i] = malloc(size);
+        }
+        for (auto i = 0; i < n; ++i) {
+            free(ptrs[i]);
+        }
+
+        auto t0 = bench::now();
+        for (auto r = 0; r < rounds; ++r) {
+            for (auto i = 0; i < n; ++i) {
+                bench::timed(lat, [&] { ptrs[i] = malloc(size); });
+            }
+            for (auto i = n - 1; i >= 0; --i) {
+                bench::timed(lat, [&] { free(ptrs[i]); });
+            }
+        }
+        auto t1 = bench::now();
+        char name[64];
+        snprintf(name, sizeof(name), "size_classes/%zu", size);
+        bench::report(name, 2 * (size_t)n * rounds, t1 - t0, lat);
+    }
+    return 0;
+}
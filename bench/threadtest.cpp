@@ -0,0 +1,64 @@
+/*
+ * Copyright 2017 Yamana Laboratory, Waseda University
+ * Supported by JST CREST Grant Number JPMJCR1503, Japan.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//  threadtest: each thread mallocs a batch of chunks and frees all of them
+//  usage: threadtest [#threads] [#iterations] [#chunks per batch] [size]
+
+#include "bench_util.hpp"
+
+#include <thread>
+
+namespace {
+    void run(int iterations, int n, size_t size, bench::Latency& lat)
+    {
+        std::vector<void *> ptrs(n);
+        for (auto it = 0; it < iterations; ++it) {
+            for (auto i = 0; i < n; ++i) {
+                bench::timed(lat, [&] { ptrs[i] = malloc(size); });
+            }
+            for (auto i = 0; i < n; ++i) {
+                bench::timed(lat, [&] { free(ptrs[i]); });
+            }
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    auto nthreads = bench::numThreads(argc, argv, 1);
+    auto iterations = bench::arg(argc, argv, 2, 100);
+    auto n = bench::arg(argc, argv, 3, 10000);
+    size_t size = bench::arg(argc, argv, 4, 64);
+    printf("threadtest: %d threads, %d iterations x %d chunks of %zuB\n", nthreads, iterations, n, size);
+    fflush(stdout);
+
+    std::vector<bench::Latency> lats(nthreads);
+    std::vector<std::thread> threads;
+    auto t0 = bench::now();
+    for (auto i = 0; i < nthreads; ++i) {
+        threads.emplace_back(run, iterations, n, size, std::ref(lats[i]));
+    }
+    for (auto& th : threads) {
+        th.join();
+    }
+    auto t1 = bench::now();
+    for (auto i = 1; i < nthreads; ++i) {
+        lats[0].Merge(lats[i]);
+    }
+    bench::report("threadtest", 2 * (size_t)nthreads * iterations * n, t1 - t0, lats[0]);
+    return 0;
+}
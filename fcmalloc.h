@@ -0,0 +1,81 @@
+/*
+ * Copyright 2017 Yamana Laboratory, Waseda University
+ * Supported by JST CREST Grant Number JPMJCR1503, Japan.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FCMALLOC_H
+#define FCMALLOC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* sizes are indexed by log2 of chunk size, e.g. sizes[14] is 16KB chunk */
+#define FCM_NUM_SIZES 65
+
+struct fcm_size_stats {
+    uint64_t allocs;        /* #malloc */
+    uint64_t frees;         /* #free */
+    uint64_t refills;       /* #refill from the common memory pool */
+    uint64_t batches;       /* #batch newly carved from mmap-ed memory */
+    uint64_t remote_frees;  /* #free of memory allocated on another core */
+    uint64_t cached_bytes;  /* bytes of free chunks cached by threads */
+    uint64_t pooled_bytes;  /* bytes of free chunks in the common memory pool */
+};
+
+struct fcm_stats {
+    uint64_t mapped_bytes;  /* bytes mmap-ed for chunks */
+    uint64_t carved_bytes;  /* bytes of mmap-ed memory carved into chunks, incl. headers */
+    uint64_t live_bytes;    /* bytes of chunks in use */
+    uint64_t cached_bytes;  /* bytes of free chunks cached by threads */
+    uint64_t pooled_bytes;  /* bytes of free chunks in the common memory pool */
+    uint32_t num_cores;
+    uint32_t num_threads;   /* #thread which has its own local memory manager */
+    struct fcm_size_stats sizes[FCM_NUM_SIZES];
+    uint64_t migrations;      /* #thread rebound to another core after migration */
+    uint64_t migrated_bytes;  /* bytes of cache flushed by the rebinding */
+    uint64_t purged_bytes;    /* bytes of free chunks released by "pool.purge" */
+};
+
+/*
+ * fill stats with counters summed over all threads.
+ * counters are read while other threads run, so they are not a snapshot.
+ * returns 0 on success.
+ */
+int fcm_get_stats(struct fcm_stats *stats);
+
+/*
+ * read and/or write a value by name, same as mallctl of jemalloc.
+ * oldp/newp points int or size_t depending on name, and both are NULL for
+ * an action like "thread.flush". see README.md for names.
+ * returns 0, or ENOENT (unknown name), EINVAL (wrong length or value) or EPERM (read only).
+ */
+int fcm_mallctl(const char *name, void *oldp, size_t *oldlenp, void *newp, size_t newlen);
+
+/*
+ * write the sampled heap profile in the legacy format of pprof.
+ * filename NULL means `FCM_PROFILE_OUTPUT.<seq>.heap`.
+ * returns 0, or ENOENT if FCM_PROFILE_SAMPLE_RATE is not set.
+ */
+int fcm_heap_profile_dump(const char *filename);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FCMALLOC_H */
@@ -20,6 +20,14 @@
 #include "memory_size_manager.hpp"
 
 #include "mem_allocate.hpp"
+#include "probes.hpp"
+
+#include "fcmalloc.h"
+
+struct alignas(FCM_CACHE_LINE_SIZE) CommonMemoryPool::CorePool {
+    pthread_mutex_t mtx;
+    MemoryLinkedListManager pool;
+};
 
 void CommonMemoryPool::Init(const int numCores, MemorySizeManager& msm)
 {
@@ -27,11 +35,10 @@ void CommonMemoryPool::Init(const int numCores, MemorySizeManager& msm)
 
     msm_ = &msm;
 
-    fcmalloc::TypeAwareMemAllocate(coreN_, &mtxsPerCore_);
-    fcmalloc::TypeAwareMemAllocate(coreN_, &poolsPerCore_);
+    fcmalloc::TypeAwareMemAllocate(coreN_, &pools_);
 
     for (auto i = 0; i < coreN_; i++) {
-        mtxsPerCore_[i] = PTHREAD_MUTEX_INITIALIZER;
+        pools_[i].mtx = PTHREAD_MUTEX_INITIALIZER;
     }
 }
 
@@ -47,16 +54,18 @@ void *CommonMemoryPool::Malloc(MemoryLinkedListManager *mllm, int core, size_t s
     auto n = msm_->GetMemorySize(index);
     ASSERT(n > 0, "Please cahnge n per size! size = %ld, 2^x(x=%d)\n", size, index);
 
+    auto i = 0;
     {
-        mtxlock l(mtxsPerCore_[core]);
-        for (auto i = 0; i < n; i++) {
-            MemoryLinkedList *newHead = poolsPerCore_[core].pop(index);
+        mtxlock l(pools_[core].mtx);
+        for (; i < n; i++) {
+            MemoryLinkedList *newHead = pools_[core].pool.pop(index);
             if (newHead == nullptr) {
                 break;
             }
             mllm->push(index, newHead);
         }
     }
+    FCM_PROBE(pool_get, core, index, i);
 
     return mllm->Malloc(size);
 }
@@ -65,6 +74,76 @@ void CommonMemoryPool::Free(MemoryLinkedListManager *mllm, int core)
 {
     ASSERT(((0 <= core) && (core < coreN_)), "core = %d\n", core);
 
-    mtxlock l(mtxsPerCore_[core]);
-    poolsPerCore_[core].Join(mllm);
+    FCM_PROBE(pool_put, core, mllm->GetAllFreeLength());
+    mtxlock l(pools_[core].mtx);
+    pools_[core].pool.Join(mllm);
+}
+
+size_t CommonMemoryPool::Purge(int indexMin, size_t pageSize)
+{
+    size_t bytes = 0;
+    for (auto i = 0; i < coreN_; i++) {
+        MemoryLinkedListManager tmp;
+        tmp.Init(coreN_);
+        {
+            mtxlock l(pools_[i].mtx);
+            for (auto j = indexMin; j < MemorySizeManager::Size - 1; ++j) {
+                pools_[i].pool.Swap(&tmp, j);
+            }
+        }
+        bytes += tmp.Purge(indexMin, pageSize);
+        mtxlock l(pools_[i].mtx);
+        pools_[i].pool.Join(&tmp);
+    }
+    return bytes;
+}
+
+size_t CommonMemoryPool::GetPooledBytes(int core) const
+{
+    size_t bytes = 0;
+    for (auto j = 0; j < FCM_NUM_SIZES - 1; ++j) {
+        bytes += pools_[core].pool.GetLengthRelaxed(j) << j;
+    }
+    return bytes;
+}
+
+void CommonMemoryPool::CollectStats(fcm_stats& stats) const
+{
+    for (auto i = 0; i < coreN_; i++) {
+        for (auto j = 0; j < FCM_NUM_SIZES - 1; ++j) {
+            stats.sizes[j].pooled_bytes += pools_[i].pool.GetLengthRelaxed(j) << j;
+        }
+    }
+}
+
+void CommonMemoryPool::PreFork()
+{
+    for (auto i = 0; i < coreN_; i++) {
+        pthread_mutex_lock(&pools_[i].mtx);
+    }
+}
+
+void CommonMemoryPool::PostForkParent()
+{
+    for (auto i = coreN_ - 1; i >= 0; i--) {
+        pthread_mutex_unlock(&pools_[i].mtx);
+    }
+}
+
+void CommonMemoryPool::PostForkChild()
+{
+    for (auto i = 0; i < coreN_; i++) {
+        pools_[i].mtx = PTHREAD_MUTEX_INITIALIZER;
+    }
+}
+
+bool CommonMemoryPool::Validate()
+{
+    for (auto i = 0; i < coreN_; i++) {
+        mtxlock l(pools_[i].mtx);
+        if (!pools_[i].pool.Validate(i)) {
+            return false;
+        }
+    }
+    return true;
 }
@@ -20,6 +20,7 @@
 
 class MemorySizeManager;
 class MemoryLinkedListManager;
+struct fcm_stats;
 
 class CommonMemoryPool {
     public:
@@ -27,11 +28,27 @@ class CommonMemoryPool {
         void *Malloc(MemoryLinkedListManager *mllm, int core, size_t size);
         void Free(MemoryLinkedListManager *mllm, int core);
 
+        //  release pages inside pooled chunks, see MemoryLinkedListManager::Purge
+        //  NOTE chunks are taken out of the pool while released, so the lock is held shortly
+        size_t Purge(int indexMin, size_t pageSize);
+
+        //  NOTE adds pooled bytes without lock
+        void CollectStats(fcm_stats& stats) const;
+        //  pooled bytes of core without lock
+        size_t GetPooledBytes(int core) const;
+        bool Validate();
+
+        //  NOTE called by pthread_atfork handlers in the order of mainPreFork
+        void PreFork();
+        void PostForkParent();
+        void PostForkChild();
+
     private:
         int coreN_;
 
         MemorySizeManager* msm_;
 
-        pthread_mutex_t* mtxsPerCore_;
-        MemoryLinkedListManager* poolsPerCore_;
+        //  NOTE defined in common_memory_pool.cpp, a mutex and a pool per core
+        struct CorePool;
+        CorePool* pools_;
 };
@@ -0,0 +1,205 @@
+/*
+ * Copyright 2017 Yamana Laboratory, Waseda University
+ * Supported by JST CREST Grant Number JPMJCR1503, Japan.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cpu_topology.hpp"
+
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+
+namespace {
+    const char* CGROUP_ROOT = "/sys/fs/cgroup";
+
+    //  read a small file as a string, returns false if it does not exist
+    bool readFile(const char* path, char* buf, size_t n)
+    {
+        auto fd = open(path, O_RDONLY);
+        if (fd == -1) {
+            return false;
+        }
+        auto len = read(fd, buf, n - 1);
+        close(fd);
+        if (len < 0) {
+            return false;
+        }
+        buf[len] = '\0';
+        return true;
+    }
+
+    bool hasController(const char* list, const char* name)
+    {
+        auto len = strlen(name);
+        if (len == 0) {
+            return *list == '\0';
+        }
+        for (auto p = list; p != nullptr; p = strchr(p, ',')) {
+            if (*p == ',') {
+                ++p;
+            }
+            if (strncmp(p, name, len) == 0 && (p[len] == ',' || p[len] == '\0')) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    //  directory of the cgroup of this process, controller "" means v2
+    //  rootLen is set to the length of the directory of the root cgroup
+    bool cgroupDir(const char* controller, char* dir, size_t n, size_t& rootLen)
+    {
+        char buf[4096];
+        if (!readFile("/proc/self/cgroup", buf, sizeof(buf))) {
+            return false;
+        }
+        //  each line is `hierarchy-ID:controller-list:cgroup-path`
+        for (auto line = buf; *line != '\0';) {
+            auto end = strchr(line, '\n');
+            if (end != nullptr) {
+                *end = '\0';
+            }
+            auto list = strchr(line, ':');
+            auto path = (list == nullptr) ? nullptr : strchr(list + 1, ':');
+            if (path != nullptr) {
+                *path = '\0';
+                if (hasController(list + 1, controller)) {
+                    rootLen = snprintf(dir, n, (*controller == '\0') ? "%s%s" : "%s/%s", CGROUP_ROOT, controller);
+                    snprintf(dir + rootLen, n - rootLen, "%s", (strcmp(path + 1, "/") == 0) ? "" : path + 1);
+                    return true;
+                }
+            }
+            if (end == nullptr) {
+                break;
+            }
+            line = end + 1;
+        }
+        return false;
+    }
+
+    //  call f with the content of file in the cgroup and its ancestors, from the leaf
+    //  until f returns false
+    template <typename F>
+    void walkCgroup(const char* controller, const char* file, F f)
+    {
+        char dir[PATH_MAX];
+        size_t rootLen;
+        if (!cgroupDir(controller, dir, sizeof(dir), rootLen)) {
+            return;
+        }
+        while (true) {
+            char path[PATH_MAX];
+            char buf[4096];
+            snprintf(path, sizeof(path), "%s/%s", dir, file);
+            if (readFile(path, buf, sizeof(buf)) && !f(buf)) {
+                return;
+            }
+            auto len = strlen(dir);
+            if (len <= rootLen) {
+                return;
+            }
+            *strrchr(dir, '/') = '\0';
+        }
+    }
+
+    //  parse a list like "0-3,8,10-11"
+    bool parseCpuList(const char* s, cpu_set_t& set)
+    {
+        CPU_ZERO(&set);
+        while (*s != '\0' && *s != '\n') {
+            char* end;
+            auto first = strtol(s, &end, 10);
+            if (end == s) {
+                return false;
+            }
+            auto last = first;
+            s = end;
+            if (*s == '-') {
+                last = strtol(s + 1, &end, 10);
+                s = end;
+            }
+            for (auto cpu = first; cpu <= last && cpu < CpuTopology::CPU_MAX; ++cpu) {
+                CPU_SET(cpu, &set);
+            }
+            if (*s == ',') {
+                ++s;
+            }
+        }
+        return CPU_COUNT(&set) > 0;
+    }
+
+    //  "max" of v2 and a huge value of v1 are unlimited
+    size_t parseMemoryLimit(const char* s)
+    {
+        if (strncmp(s, "max", 3) == 0) {
+            return 0;
+        }
+        auto v = strtoull(s, nullptr, 10);
+        return (v >= (1ull << 62)) ? 0 : v;
+    }
+}
+
+void CpuTopology::Init()
+{
+    cpu_set_t mask;
+    if (sched_getaffinity(0, sizeof(mask), &mask) != 0) {
+        CPU_ZERO(&mask);
+        auto n = sysconf(_SC_NPROCESSORS_ONLN);
+        for (auto cpu = 0; cpu < n && cpu < CPU_MAX; ++cpu) {
+            CPU_SET(cpu, &mask);
+        }
+    }
+
+    //  NOTE the affinity mask is usually within cpuset, but is not if it was set before
+    //  the process was moved to the cgroup
+    cpu_set_t cpuset;
+    auto found = false;
+    auto cpusetFile = [&](const char* s) {
+        found = parseCpuList(s, cpuset);
+        return !found;
+    };
+    walkCgroup("", "cpuset.cpus.effective", cpusetFile);
+    if (!found) {
+        walkCgroup("cpuset", "cpuset.effective_cpus", cpusetFile);
+    }
+    if (found) {
+        cpu_set_t usable;
+        CPU_AND(&usable, &mask, &cpuset);
+        if (CPU_COUNT(&usable) > 0) {
+            mask = usable;
+        }
+    }
+
+    slotN_ = 0;
+    for (auto cpu = 0; cpu < CPU_MAX; ++cpu) {
+        slots_[cpu] = CPU_ISSET(cpu, &mask) ? slotN_++ : -1;
+    }
+    if (slotN_ == 0) {
+        slotN_ = 1;
+    }
+
+    //  NOTE the limit of a cgroup is the smallest one of its ancestors
+    memoryLimit_ = 0;
+    auto memoryFile = [&](const char* s) {
+        auto limit = parseMemoryLimit(s);
+        if (limit > 0 && (memoryLimit_ == 0 || limit < memoryLimit_)) {
+            memoryLimit_ = limit;
+        }
+        return true;
+    };
+    walkCgroup("", "memory.max", memoryFile);
+    walkCgroup("memory", "memory.limit_in_bytes", memoryFile);
+}
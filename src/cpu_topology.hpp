@@ -0,0 +1,53 @@
+/*
+ * Copyright 2017 Yamana Laboratory, Waseda University
+ * Supported by JST CREST Grant Number JPMJCR1503, Japan.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "common.hpp"
+
+#include <sched.h>
+
+//  CPUs usable by this process and its memory limit, from the affinity mask and cgroup
+//  (cpuset.cpus.effective and memory.max of v2, or cpuset.effective_cpus and
+//  memory.limit_in_bytes of v1). usable CPUs are numbered by slots 0, 1, ...
+//  NOTE read once at start without malloc, so later changes of affinity are not followed
+class CpuTopology {
+    public:
+        static const int CPU_MAX = CPU_SETSIZE;
+
+        void Init();
+
+        //  #usable CPU, which is used as #core by the other classes
+        int GetSlotN() const { return slotN_; }
+        //  NOTE a CPU which was not usable at start shares the slot of cpu % #slot
+        int ToSlot(int cpu) const
+        {
+            if (0 <= cpu && cpu < CPU_MAX && slots_[cpu] >= 0) {
+                return slots_[cpu];
+            }
+            return (cpu < 0) ? 0 : cpu % slotN_;
+        }
+        int GetCurrentSlot() const { return ToSlot(sched_getcpu()); }
+
+        //  bytes, 0 means unlimited
+        size_t GetMemoryLimit() const { return memoryLimit_; }
+
+    private:
+        short slots_[CPU_MAX];
+        int slotN_;
+        size_t memoryLimit_;
+};
@@ -20,12 +20,24 @@
 #include "common.hpp"
 #include "mmap_manager.hpp"
 #include "common_memory_pool.hpp"
+#include "cpu_topology.hpp"
+#include "fcmalloc_inline.hpp"
 #include "global_memory_manager.hpp"
+#include "heap_profiler.hpp"
+#include "latency_recorder.hpp"
+#include "trace_recorder.hpp"
 #include "local_memory_manager.hpp"
+#include "mallctl.hpp"
+#include "mem_logger.hpp"
 #include "memory_linked_list.hpp"
 #include "memory_linked_list_manager.hpp"
 #include "mem_allocate.hpp"
 #include "memory_size_manager.hpp"
+#include "stats_publisher.hpp"
+
+#include "fcmalloc.h"
+
+#include <malloc.h>
 
 using namespace std;
 
@@ -36,11 +48,21 @@ void free(void *p);
 
 MmapManager mm;
 thread_local bool mainThreadFlag = false;
+thread_local LocalMemoryManager *fcmalloc::lp = nullptr;
+
+using fcmalloc::lp;
 
 namespace {
     GlobalMemoryManager g;
-    thread_local LocalMemoryManager *lp = nullptr;
+    thread_local bool threadTermFlag = false;
     CommonMemoryPool cmp;
+    CpuTopology topo;
+    HeapProfiler prof;
+    TraceRecorder trace;
+    MemLogger memLog;
+    LatencyRecorder lat;
+    Mallctl ctl;
+    StatsPublisher pub;
     int numCores = 0;
     pthread_mutex_t dummy_mtx = PTHREAD_MUTEX_INITIALIZER;
 
@@ -55,7 +77,8 @@ void mainInit()
 {
     mainThreadFlag = true;
 
-    numCores = sysconf(_SC_NPROCESSORS_ONLN);
+    topo.Init();
+    numCores = topo.GetSlotN();
     auto pageSize = sysconf(_SC_PAGESIZE);
 
     const size_t unit1GB       = 1024 * 1024 * 1024;
@@ -75,77 +98,202 @@ void mainInit()
     if(subMemoryMaxStr) {
         subMemoryMax = atoll(subMemoryMaxStr);
     }
+    //  NOTE regions are touched at start, so the defaults are kept within
+    //  a quarter of the memory limit of cgroup
+    auto memoryLimit = topo.GetMemoryLimit();
+    if (memoryLimit > 0) {
+        auto quarter = memoryLimit / 4 / unit1MB;
+        if (!mainMemoryMaxStr && mainMemoryMax > quarter / 2) {
+            mainMemoryMax = (quarter / 2 > 0) ? quarter / 2 : 1;
+        }
+        if (!subMemoryMaxStr && subMemoryMax > quarter / 2) {
+            subMemoryMax = (quarter / 2 > 0) ? quarter / 2 : 1;
+        }
+    }
     mm.Init(numCores, pageSize, mainMemoryMax * unit1MB, subMemoryMax * unit1MB);
     mm.SetForceMmapFlag(forceExtendMemFlag);
+    if (memoryLimit > 0 && memoryLimit < unit1GB) {
+        mm.SetExtendSize((memoryLimit / 16 > 4 * unit1MB) ? memoryLimit / 16 : 4 * unit1MB);
+    }
+    auto reserveSize = 4u;
+    auto reserveSizeStr = getenv("FCM_MMAP_RESERVE_SIZE");
+    if(reserveSizeStr) {
+        reserveSize = atoll(reserveSizeStr);
+    }
+    mm.SetReserveSize(reserveSize * unit1MB);
     cmp.Init(numCores, msm());
-    g.Init(numCores, cmp, msm());
+    prof.Init();
+    g.Init(numCores, cmp, msm(), prof);
+    g.SetTopology(topo);
+    trace.Init(numCores * g.GetPoolN());
+    g.SetTrace(trace);
+    memLog.Init(numCores, numCores * g.GetPoolN());
+    g.SetMemLog(memLog);
+    lat.Init(numCores * g.GetPoolN(), mm.GetRegionN());
+    mm.SetLatency(lat);
+    g.SetLatency(lat);
+    ctl.Init(numCores, g, cmp, mm, msm(), prof, lat);
+    pub.Init(numCores, ctl, g, cmp, mm);
+}
+void mainStart()
+{
+    trace.Start();
+    memLog.Start();
+    ctl.Start();
+    pub.Start();
 }
 void mainTerm()
 {
+    trace.Term();
+    memLog.Term();
+    if (prof.IsEnabled()) {
+        prof.DumpNext();
+    }
+    if (lat.IsEnabled()) {
+        lat.DumpNext();
+    }
+    pub.Term();
     mm.Term();
 }
 
+//  NOTE every lock is acquired in this order, which follows the nesting of locks:
+//  mmap manager prints while extending memory, and printf may call malloc
+void mainPreFork()
+{
+    mm.PreFork();
+    g.PreFork();
+    cmp.PreFork();
+    prof.PreFork();
+    trace.PreFork();
+    memLog.PreFork();
+}
+void mainPostForkParent()
+{
+    memLog.PostForkParent();
+    trace.PostForkParent();
+    prof.PostForkParent();
+    cmp.PostForkParent();
+    g.PostForkParent();
+    mm.PostForkParent();
+}
+void mainPostForkChild()
+{
+    memLog.PostForkChild();
+    trace.PostForkChild();
+    g.SetTrace(trace);
+    prof.PostForkChild();
+    cmp.PostForkChild();
+    g.PostForkChild(lp);
+    mm.PostForkChild();
+}
+
 void threadInit()
 {
     int core;
-    core = sched_getcpu();
+    core = topo.GetCurrentSlot();
     lp = g.AllocLocalMemoryManager(core);
     ASSERT(lp != nullptr, "lp is null\n");
+    lp->SetOwner(&lp);
 }
 void threadTerm()
 {
     if (lp != nullptr) {
+        lp->SetOwner(nullptr);
         g.FreeLocalMemoryManager(lp);
         lp = nullptr;
     }
+    threadTermFlag = true;
 }
 
-void *malloc(size_t size)
-{
-    init_();
+namespace {
+    //  NOTE initialize the calling thread, or borrow a LocalMemoryManager
+    //  after the thread has been terminated
+    FCM_ALLOC_TEXT void *mallocSlow(size_t size)
+    {
+        if (threadTermFlag) {
+            return g.Malloc(topo.GetCurrentSlot(), size);
+        }
+        init_();
+        if (lp == nullptr) {
+            errno = ENOMEM;
+            return nullptr;
+        }
+        return lp->Malloc(size);
+    }
 
+    //  NOTE a block aligned beyond the body alignment is carved from a chunk of
+    //  alignment - 16 bytes more, and the word right before it points to the body of the chunk
+    FCM_ALLOC_TEXT void *alignedMalloc(size_t alignment, size_t size)
+    {
+        auto extra = alignment - MemorySizeManager::BaseAlignment;
+        if (size > SIZE_MAX / 2 - extra) {
+            return nullptr;
+        }
+        auto body = malloc(size + extra);
+        if (body == nullptr) {
+            return nullptr;
+        }
+        auto ptr = (void *)ALIGN(body, alignment);
+        if (ptr != body) {
+            *((void **)ptr - 1) = body;
+        }
+        return ptr;
+    }
+
+    void freeSlow(void *ptr)
+    {
+        if (!threadTermFlag) {
+            init_();
+        }
+        if (lp == nullptr) {
+            g.Free(ptr);
+            return;
+        }
+        lp->Free(ptr);
+    }
+}
+
+FCM_ALLOC_TEXT void *malloc(size_t size)
+{
+    auto lm = lp;
     if (size == 0) {
         return nullptr;
     }
-
-    ASSERT(lp != nullptr, "lp is null\n");
-    void *ptr = lp->Malloc(size);
-    return ptr;
+    if (lm == nullptr) {
+        return mallocSlow(size);
+    }
+    return lm->Malloc(size);
 }
 void free(void *ptr)
 {
-    init_();
-
+    auto lm = lp;
     if (ptr == nullptr) {
         return;
     }
     ASSERT(ALIGN_CHECK(ptr, 16), "free addr. align. error %ld\n", ALIGN_REMAIN(ptr, 16));
 
-    if (lp == nullptr) {
-        g.Free(ptr);
+    if (lm == nullptr) {
+        freeSlow(ptr);
         return;
     }
-    ASSERT(lp != nullptr, "lp is null\n");
-    lp->Free(ptr);
+    lm->Free(ptr);
 
-    {
+    if (mainThreadFlag) {
         static thread_local int cntsPerSize[MemorySizeManager::Size];
         size_t size = MemUtil::PtrToSize(ptr);
         int index = logarithm2(size);
         int freeCntInterval = msm().GetMemorySize(index);
         ASSERT(freeCntInterval > 0, "Please cahnge n per size! size = %ld, 2^x(x=%d)\n", size, index);
         ++cntsPerSize[index];
-        if (mainThreadFlag && cntsPerSize[index] > freeCntInterval) {
+        if (cntsPerSize[index] > freeCntInterval) {
             memset(cntsPerSize, 0, MemorySizeManager::Size * sizeof(int));
-            lp->AllFreeToCommonMemoryPool();
+            lm->AllFreeToCommonMemoryPool();
         }
     }
 }
 
-void *calloc(size_t nmemb, size_t size)
+FCM_ALLOC_TEXT void *calloc(size_t nmemb, size_t size)
 {
-    init_();
-
     if (nmemb == 0 || size == 0) {
         return nullptr;
     }
@@ -161,16 +309,196 @@ void *calloc(size_t nmemb, size_t size)
     return ptr;
 }
 
-void *realloc(void *ptr, size_t size) throw()
+//  NOTE alignment up to the body alignment of FCM_ALIGNMENT is served by bodies,
+//  and larger one by blocks inside larger chunks
+FCM_ALLOC_TEXT int posix_memalign(void **memptr, size_t alignment, size_t size) throw()
+{
+    if (alignment < sizeof(void *) || (alignment & (alignment - 1)) != 0) {
+        return EINVAL;
+    }
+    void *ptr;
+    if (alignment <= MemorySizeManager::BaseAlignment) {
+        ptr = malloc(size);
+    }
+    else if (alignment <= msm().GetMaxAlignment()) {
+        //  NOTE only bodies of FCM_ALIGNMENT or more are aligned beyond 16B
+        auto maxAlignment = msm().GetMaxAlignment();
+        ptr = malloc((size < maxAlignment) ? maxAlignment : size);
+    }
+    else {
+        ptr = alignedMalloc(alignment, size);
+    }
+    if (ptr == nullptr && size > 0) {
+        return ENOMEM;
+    }
+    *memptr = ptr;
+    return 0;
+}
+
+FCM_ALLOC_TEXT void *aligned_alloc(size_t alignment, size_t size) throw()
+{
+    void *ptr = nullptr;
+    auto err = posix_memalign(&ptr, (alignment < sizeof(void *)) ? sizeof(void *) : alignment, size);
+    if (err != 0) {
+        errno = err;
+        return nullptr;
+    }
+    return ptr;
+}
+
+FCM_ALLOC_TEXT void *memalign(size_t alignment, size_t size) throw()
+{
+    return aligned_alloc(alignment, size);
+}
+
+//  NOTE interposed, since free of FCMalloc cannot take chunks of libc
+FCM_ALLOC_TEXT void *valloc(size_t size) throw()
 {
-    init_();
+    return aligned_alloc(sysconf(_SC_PAGESIZE), size);
+}
+
+FCM_ALLOC_TEXT void *pvalloc(size_t size) throw()
+{
+    auto pageSize = (size_t)sysconf(_SC_PAGESIZE);
+    if (size > SIZE_MAX - pageSize) {
+        errno = ENOMEM;
+        return nullptr;
+    }
+    return aligned_alloc(pageSize, (size == 0) ? pageSize : ALIGN(size, pageSize));
+}
 
+FCM_ALLOC_TEXT void *realloc(void *ptr, size_t size) throw()
+{
     if (ptr == nullptr) {
         return malloc(size);
     }
     ASSERT(ALIGN_CHECK(ptr, 16), "realloc addr. align. error %ld\n", ALIGN_REMAIN(ptr, 16));
 
-    ASSERT(lp != nullptr, "lp is null\n");
+    if (lp == nullptr) {
+        if (!threadTermFlag) {
+            init_();
+        }
+        if (lp == nullptr) {
+            return g.Realloc(topo.GetCurrentSlot(), ptr, size);
+        }
+    }
     void *newPtr = lp->Realloc(ptr, size);
     return newPtr;
-}
\ No newline at end of file
+}
+
+int fcm_get_stats(fcm_stats *stats)
+{
+    if (stats == nullptr) {
+        return EINVAL;
+    }
+    ctl.CollectStats(*stats);
+    return 0;
+}
+
+int fcm_mallctl(const char *name, void *oldp, size_t *oldlenp, void *newp, size_t newlen)
+{
+    return ctl.Call(lp, name, oldp, oldlenp, newp, newlen);
+}
+
+int fcm_heap_profile_dump(const char *filename)
+{
+    return (filename == nullptr) ? prof.DumpNext() : prof.Dump(filename);
+}
+
+struct mallinfo2 mallinfo2() throw()
+{
+    fcm_stats stats;
+    ctl.CollectStats(stats);
+
+    struct mallinfo2 mi;
+    memset(&mi, 0, sizeof(mi));
+    mi.arena    = stats.mapped_bytes;
+    mi.uordblks = stats.live_bytes;
+    mi.fordblks = stats.cached_bytes + stats.pooled_bytes;
+    for (auto i = 0; i < FCM_NUM_SIZES - 1; ++i) {
+        mi.ordblks += (stats.sizes[i].cached_bytes + stats.sizes[i].pooled_bytes) >> i;
+    }
+    return mi;
+}
+
+struct mallinfo mallinfo() throw()
+{
+    //  NOTE values are truncated as glibc does
+    auto mi2 = mallinfo2();
+    struct mallinfo mi;
+    memset(&mi, 0, sizeof(mi));
+    mi.arena    = (int)mi2.arena;
+    mi.ordblks  = (int)mi2.ordblks;
+    mi.uordblks = (int)mi2.uordblks;
+    mi.fordblks = (int)mi2.fordblks;
+    return mi;
+}
+
+//  NOTE printed without malloc
+void malloc_stats() throw()
+{
+    fcm_stats stats;
+    ctl.CollectStats(stats);
+
+    const size_t unit1MB = 1024 * 1024;
+    myprintf(stderr_fd, "fcmalloc: #cores = %d, #threads = %d\n", (int)stats.num_cores, (int)stats.num_threads);
+    myprintf(stderr_fd, "mapped bytes = %14lu\n", (size_t)stats.mapped_bytes);
+    myprintf(stderr_fd, "carved bytes = %14lu\n", (size_t)stats.carved_bytes);
+    myprintf(stderr_fd, "in use bytes = %14lu\n", (size_t)stats.live_bytes);
+    myprintf(stderr_fd, "cached bytes = %14lu\n", (size_t)stats.cached_bytes);
+    myprintf(stderr_fd, "pooled bytes = %14lu\n", (size_t)stats.pooled_bytes);
+    myprintf(stderr_fd, "migrations   = %14lu (%lu bytes flushed)\n", (size_t)stats.migrations, (size_t)stats.migrated_bytes);
+    myprintf(stderr_fd, "purged bytes = %14lu\n", (size_t)stats.purged_bytes);
+    myprintf(stderr_fd, "region  mapped[MB]    used[MB]\n");
+    for (auto i = 0; i < mm.GetRegionN(); ++i) {
+        myprintf(stderr_fd, "%6d %11lu %11lu\n", i, mm.GetMappedSize(i) / unit1MB, mm.GetUsedSize(i) / unit1MB);
+    }
+    myprintf(stderr_fd, "  size      #malloc        #free  #refill   #batch      #remote     cached[B]     pooled[B]\n");
+    for (auto i = 0; i < FCM_NUM_SIZES - 1; ++i) {
+        auto& s = stats.sizes[i];
+        if (s.allocs == 0 && s.frees == 0) {
+            continue;
+        }
+        myprintf(stderr_fd, "2^%2d   %12lu %12lu %8lu %8lu %12lu %13lu %13lu\n", i,
+                (size_t)s.allocs, (size_t)s.frees, (size_t)s.refills, (size_t)s.batches,
+                (size_t)s.remote_frees, (size_t)s.cached_bytes, (size_t)s.pooled_bytes);
+    }
+}
+
+int malloc_info(int options, FILE *fp) throw()
+{
+    if (options != 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    fcm_stats stats;
+    ctl.CollectStats(stats);
+
+    fprintf(fp, "<malloc version=\"fcmalloc-1\">\n");
+    for (auto i = 0; i < mm.GetRegionN(); ++i) {
+        fprintf(fp, "<heap nr=\"%d\">\n", i);
+        fprintf(fp, "<system type=\"current\" size=\"%zu\"/>\n", mm.GetMappedSize(i));
+        fprintf(fp, "<system type=\"carved\" size=\"%zu\"/>\n", mm.GetUsedSize(i));
+        fprintf(fp, "</heap>\n");
+    }
+    fprintf(fp, "<sizes>\n");
+    for (auto i = 0; i < FCM_NUM_SIZES - 1; ++i) {
+        auto& s = stats.sizes[i];
+        if (s.allocs == 0 && s.frees == 0) {
+            continue;
+        }
+        fprintf(fp, "<size from=\"%zu\" to=\"%zu\" allocs=\"%zu\" frees=\"%zu\" refills=\"%zu\""
+                " batches=\"%zu\" remote_frees=\"%zu\" cached=\"%zu\" pooled=\"%zu\"/>\n",
+                (i == 3) ? (size_t)1 : ((size_t)1 << (i - 1)) + 1, (size_t)1 << i,
+                (size_t)s.allocs, (size_t)s.frees, (size_t)s.refills, (size_t)s.batches,
+                (size_t)s.remote_frees, (size_t)s.cached_bytes, (size_t)s.pooled_bytes);
+    }
+    fprintf(fp, "</sizes>\n");
+    fprintf(fp, "<total type=\"inuse\" size=\"%zu\"/>\n", (size_t)stats.live_bytes);
+    fprintf(fp, "<total type=\"cached\" size=\"%zu\"/>\n", (size_t)stats.cached_bytes);
+    fprintf(fp, "<total type=\"pooled\" size=\"%zu\"/>\n", (size_t)stats.pooled_bytes);
+    fprintf(fp, "<system type=\"current\" size=\"%zu\"/>\n", (size_t)stats.mapped_bytes);
+    fprintf(fp, "<system type=\"carved\" size=\"%zu\"/>\n", (size_t)stats.carved_bytes);
+    fprintf(fp, "</malloc>\n");
+    return 0;
+}
@@ -0,0 +1,58 @@
+/*
+ * Copyright 2017 Yamana Laboratory, Waseda University
+ * Supported by JST CREST Grant Number JPMJCR1503, Japan.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "local_memory_manager.hpp"
+
+#include "fcmalloc.h"
+
+#include <cstdlib>
+
+//  fast paths of malloc and free for applications linking libfcmalloc.a, which are
+//  inlined at call sites. slow paths and the first call of each thread go to malloc/free
+//  NOTE build the application with the same macros as the library (e.g. FCM_CACHE_LINE_SIZE),
+//  and with -ftls-model=initial-exec if the code is in a shared library
+
+extern thread_local bool mainThreadFlag;
+
+namespace fcmalloc {
+
+    //  local memory manager of the calling thread, nullptr until its first malloc/free
+    extern thread_local LocalMemoryManager *lp;
+
+    inline void *Malloc(size_t size)
+    {
+        auto lm = lp;
+        if (lm == nullptr || size == 0) {
+            return ::malloc(size);
+        }
+        return lm->Malloc(size);
+    }
+
+    //  NOTE free of the main thread also returns remote memory periodically, so it is not inlined
+    inline void Free(void *ptr)
+    {
+        auto lm = lp;
+        if (lm == nullptr || ptr == nullptr || mainThreadFlag) {
+            ::free(ptr);
+            return;
+        }
+        lm->Free(ptr);
+    }
+
+} // namespace fcmalloc
@@ -16,11 +16,22 @@
  */
 
 #include "common_memory_pool.hpp"
+#include "cpu_topology.hpp"
 #include "global_memory_manager.hpp"
+#include "heap_profiler.hpp"
 #include "local_memory_manager.hpp"
 #include "mem_allocate.hpp"
 
-void GlobalMemoryManager::Init(int numCores, CommonMemoryPool& cmp, MemorySizeManager& msm)
+#include "fcmalloc.h"
+
+//  lists of a local memory manager, aligned so that managers share no line
+struct alignas(FCM_CACHE_LINE_SIZE) GlobalMemoryManager::ManagerLists {
+    MemoryLinkedListManager malloc;
+    MemoryLinkedListManager free;
+    RemoteFreeList remotes[REMOTE_FREE_N];
+};
+
+void GlobalMemoryManager::Init(int numCores, CommonMemoryPool& cmp, MemorySizeManager& msm, HeapProfiler& prof)
 {
     mtx_ = PTHREAD_MUTEX_INITIALIZER;
 
@@ -32,50 +43,113 @@ void GlobalMemoryManager::Init(int numCores, CommonMemoryPool& cmp, MemorySizeMa
     else {
         poolN_ = atoi(poolStr);
     }
+    //  NOTE unit is MB
+    auto cacheStr = getenv("FCM_THREAD_CACHE_MAX");
+    cacheBudget_ = (cacheStr == nullptr) ? 0 : atoll(cacheStr) * 1024 * 1024;
+    unclaimedCacheBytes_ = cacheBudget_;
+    stealOffset_ = 0;
+    flushEpoch_ = 0;
+    //  NOTE #call of mallocSlow between checks of the current core
+    auto migrationStr = getenv("FCM_MIGRATION_CHECK_INTVL");
+    migrationIntvl_ = (migrationStr == nullptr) ? 16 : atoi(migrationStr);
+    topo_ = nullptr;
 
     fcmalloc::TypeAwareMemAllocate(coreN_ * poolN_, &poolFlags_);
-    fcmalloc::TypeAwareMemAllocate(coreN_ * (coreN_ + 1) * poolN_, &memoryPools_);
+    //  NOTE metadata grows linearly with cores, since remote free lists are of fixed number
+    fcmalloc::TypeAwareMemAllocate(coreN_ * poolN_, &lists_);
     fcmalloc::TypeAwareMemAllocate(coreN_ * poolN_, &managerPools_);
 
-    const int npool = coreN_ * (coreN_ + 1) * poolN_;
-    for (auto i = 0; i < npool; ++i) {
-        memoryPools_[i].Init(coreN_);
-    }
-    auto cnt = 0;
     for (auto j = 0; j < coreN_; ++j) {
         auto core = j;
         for (auto i = 0; i < poolN_; ++i) {
-            poolFlags_[poolN_ * core + i] = false;
-            auto& m = managerPools_[poolN_ * core + i];
-            m.Init(coreN_, cmp, msm);
+            auto index = poolN_ * core + i;
+            poolFlags_[index] = false;
+            auto& lists = lists_[index];
+            lists.malloc.Init(coreN_);
+            lists.free.Init(coreN_);
+            auto& m = managerPools_[index];
+            m.Init(coreN_, *this, cmp, msm, prof);
             m.SetCore(core);
-            m.SetMalloc(&memoryPools_[cnt + 0]);
-            for (auto k = 0; k < coreN_; ++k) {
-                auto fcore = k;
-                m.SetFree(fcore, &memoryPools_[cnt + 1 + k]);
-            }
-            cnt += 1 + coreN_;
+            m.SetMalloc(&lists.malloc);
+            m.SetFree(&lists.free, lists.remotes);
         }
     }
 }
 
-LocalMemoryManager *GlobalMemoryManager::AllocLocalMemoryManager(int core)
+void GlobalMemoryManager::SetTrace(TraceRecorder& trace)
+{
+    const int n = coreN_ * poolN_;
+    for (auto i = 0; i < n; ++i) {
+        managerPools_[i].SetTrace(&trace, trace.GetRing(i));
+    }
+}
+
+void GlobalMemoryManager::SetMemLog(MemLogger& log)
+{
+    const int n = coreN_ * poolN_;
+    for (auto i = 0; i < n; ++i) {
+        managerPools_[i].SetMemLog(&log, log.GetRing(i));
+    }
+}
+
+void GlobalMemoryManager::SetLatency(LatencyRecorder& lat)
+{
+    const int n = coreN_ * poolN_;
+    for (auto i = 0; i < n; ++i) {
+        managerPools_[i].SetLatency(lat.GetChunkSet(i));
+    }
+}
+
+int GlobalMemoryManager::GetCurrentCore() const
+{
+    return (topo_ == nullptr) ? sched_getcpu() : topo_->GetCurrentSlot();
+}
+
+//  NOTE called with mtx_ locked, returns nullptr if all managers of core are used
+LocalMemoryManager *GlobalMemoryManager::allocLocked(int core)
 {
     static int offset = -1;
-    mtxlock l(mtx_);
     offset = (offset + 1) % poolN_;
 
     for (auto i = 0; i < poolN_; i++) {
         auto index = poolN_ * core + (offset + i) % poolN_;
         if (!poolFlags_[index]) {
             poolFlags_[index] = true;
-            return &managerPools_[index];
+            auto& m = managerPools_[index];
+            if (cacheBudget_ > 0) {
+                m.SetCacheBudget(0);
+                claimCacheBudget(&m, CACHE_BUDGET_MIN, fairCacheBudget());
+                m.RecountCache();
+            }
+            return &m;
         }
     }
-    ASSERT(false, "Allocate more pool!\n");
     return nullptr;
 }
 
+LocalMemoryManager *GlobalMemoryManager::AllocLocalMemoryManager(int core)
+{
+    mtxlock l(mtx_);
+    auto m = allocLocked(core);
+    ASSERT(m != nullptr, "Allocate more pool!\n");
+    return m;
+}
+
+LocalMemoryManager *GlobalMemoryManager::Rebind(LocalMemoryManager *m, int core)
+{
+    LocalMemoryManager *n;
+    {
+        mtxlock l(mtx_);
+        n = allocLocked(core);
+    }
+    if (n == nullptr) {
+        return m;
+    }
+    m->Flush();
+    FreeLocalMemoryManager(m);
+    return n;
+}
+
 void GlobalMemoryManager::FreeLocalMemoryManagerOtherNodeMallocLinkedList(LocalMemoryManager *m)
 {
     mtxlock l(mtx_);
@@ -112,6 +186,9 @@ void GlobalMemoryManager::FreeLocalMemoryManager(LocalMemoryManager *m)
                     }
                 }
                 poolFlags_[poolN_ * core + i] = false;
+                if (cacheBudget_ > 0) {
+                    unclaimedCacheBytes_ += m->GetCacheBudget();
+                }
                 return;
             }
         }
@@ -120,6 +197,30 @@ void GlobalMemoryManager::FreeLocalMemoryManager(LocalMemoryManager *m)
     return;
 }
 
+void *GlobalMemoryManager::Malloc(int core, size_t size)
+{
+    auto lp = AllocLocalMemoryManager(core);
+    if (lp == nullptr) {
+        errno = ENOMEM;
+        return nullptr;
+    }
+    auto ptr = lp->Malloc(size);
+    FreeLocalMemoryManager(lp);
+    return ptr;
+}
+
+void *GlobalMemoryManager::Realloc(int core, void *ptr, size_t size)
+{
+    auto lp = AllocLocalMemoryManager(core);
+    if (lp == nullptr) {
+        errno = ENOMEM;
+        return nullptr;
+    }
+    auto newPtr = lp->Realloc(ptr, size);
+    FreeLocalMemoryManager(lp);
+    return newPtr;
+}
+
 void GlobalMemoryManager::Free(void *ptr)
 {
     auto core = MemUtil::PtrToCore(ptr);
@@ -127,3 +228,155 @@ void GlobalMemoryManager::Free(void *ptr)
     lp->Free(ptr);
     FreeLocalMemoryManager(lp);
 }
+
+void GlobalMemoryManager::PostForkChild(LocalMemoryManager *survivor)
+{
+    mtx_ = PTHREAD_MUTEX_INITIALIZER;
+    //  NOTE another thread may have been in the middle of malloc/free,
+    //  so memory chunks cached by other threads are dropped in the child
+    const int n = coreN_ * poolN_;
+    for (auto i = 0; i < n; ++i) {
+        auto& m = managerPools_[i];
+        if (poolFlags_[i] && &m != survivor) {
+            m.Discard();
+            poolFlags_[i] = false;
+            if (cacheBudget_ > 0) {
+                unclaimedCacheBytes_ += m.GetCacheBudget();
+            }
+        }
+    }
+}
+
+//  NOTE called with mtx_ locked. budget is taken from the unclaimed rest first,
+//  and then from other threads in round robin, which keep `keep` bytes at least
+void GlobalMemoryManager::claimCacheBudget(LocalMemoryManager *m, size_t bytes, size_t keep)
+{
+    auto claimed = (unclaimedCacheBytes_ < bytes) ? unclaimedCacheBytes_ : bytes;
+    unclaimedCacheBytes_ -= claimed;
+
+    const int n = coreN_ * poolN_;
+    for (auto i = 0; i < n && claimed < bytes; ++i) {
+        stealOffset_ = (stealOffset_ + 1) % n;
+        auto& victim = managerPools_[stealOffset_];
+        if (!poolFlags_[stealOffset_] || &victim == m) {
+            continue;
+        }
+        auto budget = victim.GetCacheBudget();
+        if (budget > keep) {
+            auto stolen = (budget - keep < bytes - claimed) ? budget - keep : bytes - claimed;
+            victim.SetCacheBudget(budget - stolen);
+            claimed += stolen;
+        }
+    }
+    m->SetCacheBudget(m->GetCacheBudget() + claimed);
+}
+
+//  NOTE called with mtx_ locked, share of each thread if the total is split evenly,
+//  and CACHE_BUDGET_STEP at most
+size_t GlobalMemoryManager::fairCacheBudget() const
+{
+    const int n = coreN_ * poolN_;
+    size_t used = 0;
+    for (auto i = 0; i < n; ++i) {
+        used += poolFlags_[i] ? 1 : 0;
+    }
+    auto share = cacheBudget_ / ((used > 0) ? used : 1);
+    return (share < CACHE_BUDGET_STEP) ? share : CACHE_BUDGET_STEP;
+}
+
+void GlobalMemoryManager::StealCacheBudget(LocalMemoryManager *m)
+{
+    if (relaxedLoad(cacheBudget_) == 0) {
+        return;
+    }
+    mtxlock l(mtx_);
+    claimCacheBudget(m, CACHE_BUDGET_STEP, CACHE_BUDGET_MIN);
+}
+
+void GlobalMemoryManager::SetCacheBudget(size_t bytes)
+{
+    mtxlock l(mtx_);
+    auto enabled = (cacheBudget_ > 0);
+    __atomic_store_n(&cacheBudget_, bytes, __ATOMIC_RELAXED);
+    unclaimedCacheBytes_ = bytes;
+
+    const int n = coreN_ * poolN_;
+    for (auto i = 0; i < n; ++i) {
+        if (poolFlags_[i]) {
+            managerPools_[i].SetCacheBudget((bytes > 0) ? 0 : (size_t)-1);
+        }
+    }
+    if (bytes > 0) {
+        for (auto i = 0; i < n; ++i) {
+            if (poolFlags_[i]) {
+                claimCacheBudget(&managerPools_[i], CACHE_BUDGET_MIN, fairCacheBudget());
+            }
+        }
+    }
+    //  NOTE cached bytes are not counted exactly while the budget is disabled,
+    //  so threads count them again by flushing
+    if (!enabled && bytes > 0) {
+        RequestFlush();
+    }
+}
+
+void GlobalMemoryManager::CollectStats(fcm_stats& stats) const
+{
+    const int n = coreN_ * poolN_;
+    for (auto i = 0; i < n; ++i) {
+        auto& m = managerPools_[i];
+        if (relaxedLoad(poolFlags_[i])) {
+            ++stats.num_threads;
+        }
+        stats.migrations     += m.GetMigrations();
+        stats.migrated_bytes += m.GetMigratedBytes();
+        for (auto j = 0; j < FCM_NUM_SIZES; ++j) {
+            auto& c = m.GetCounters(j);
+            auto& s = stats.sizes[j];
+            s.allocs       += relaxedLoad(c.allocs);
+            s.frees        += relaxedLoad(c.frees);
+            s.refills      += relaxedLoad(c.refills);
+            s.batches      += relaxedLoad(c.batches);
+            s.remote_frees += relaxedLoad(c.remoteFrees);
+            if (j < FCM_NUM_SIZES - 1) {
+                s.cached_bytes += m.GetCachedLength(j) << j;
+            }
+        }
+    }
+}
+
+size_t GlobalMemoryManager::GetCachedBytes(int core) const
+{
+    size_t bytes = 0;
+    for (auto i = poolN_ * core; i < poolN_ * (core + 1); ++i) {
+        for (auto j = 0; j < FCM_NUM_SIZES - 1; ++j) {
+            bytes += managerPools_[i].GetCachedLength(j) << j;
+        }
+    }
+    return bytes;
+}
+
+size_t GlobalMemoryManager::Purge(int indexMin, size_t pageSize)
+{
+    mtxlock l(mtx_);
+    size_t bytes = 0;
+    const int n = coreN_ * poolN_;
+    for (auto i = 0; i < n; ++i) {
+        if (!poolFlags_[i]) {
+            bytes += managerPools_[i].Purge(indexMin, pageSize);
+        }
+    }
+    return bytes;
+}
+
+bool GlobalMemoryManager::Validate()
+{
+    mtxlock l(mtx_);
+    const int n = coreN_ * poolN_;
+    for (auto i = 0; i < n; ++i) {
+        if (!poolFlags_[i] && !managerPools_[i].Validate()) {
+            return false;
+        }
+    }
+    return true;
+}
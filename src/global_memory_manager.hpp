@@ -19,29 +19,97 @@
 
 #include "common.hpp"
 
+struct fcm_stats;
+
 class CommonMemoryPool;
+class CpuTopology;
+class HeapProfiler;
+class LatencyRecorder;
 class LocalMemoryManager;
-class MemoryLinkedListManager;
 class MemorySizeManager;
+class MemLogger;
+class TraceRecorder;
 
 // default pool size
 #define POOL_N 4
 
+// per-thread cache budget claimed at thread start and moved at once between threads
+// NOTE a thread gives budget to new threads down to CACHE_BUDGET_STEP or an even split
+// of the total, and to threads running out of it down to CACHE_BUDGET_MIN
+#define CACHE_BUDGET_MIN (64ul * 1024 * 1024)
+#define CACHE_BUDGET_STEP (16ul * 1024 * 1024)
+
 class GlobalMemoryManager {
     public:
-        void Init(int numCores, CommonMemoryPool& cmp, MemorySizeManager& msm);
+        void Init(int numCores, CommonMemoryPool& cmp, MemorySizeManager& msm, HeapProfiler& prof);
+        //  give each local memory manager its own ring
+        void SetTrace(TraceRecorder& trace);
+        void SetMemLog(MemLogger& log);
+        void SetLatency(LatencyRecorder& lat);
+        //  NOTE without topology, a CPU number is used as a core as it is
+        void SetTopology(CpuTopology& topo) { topo_ = &topo; }
+        int GetCurrentCore() const;
         LocalMemoryManager *AllocLocalMemoryManager(int core);
         void FreeLocalMemoryManager(LocalMemoryManager *m);
+        //  move the thread of m to a manager of core, and flush the cache of m
+        //  to the common memory pool. returns m if all managers of core are used
+        LocalMemoryManager *Rebind(LocalMemoryManager *m, int core);
         void FreeLocalMemoryManagerOtherNodeMallocLinkedList(LocalMemoryManager *m);
+        FCM_ALLOC_TEXT void *Malloc(int core, size_t size);
+        FCM_ALLOC_TEXT void *Realloc(int core, void *ptr, size_t size);
         void Free(void *ptr);
+        void StealCacheBudget(LocalMemoryManager *m);
+
+        int GetPoolN() const { return poolN_; }
+        size_t GetCacheBudget() const { return relaxedLoad(cacheBudget_); }
+        //  NOTE budget of every running thread is claimed again as at thread start
+        void SetCacheBudget(size_t bytes);
+
+        //  every thread flushes its cache when it refills next time
+        void RequestFlush() { __atomic_add_fetch(&flushEpoch_, 1, __ATOMIC_RELAXED); }
+        size_t GetFlushEpoch() const { return relaxedLoad(flushEpoch_); }
+
+        //  0 disables rebinding of migrated threads
+        int GetMigrationIntvl() const { return relaxedLoad(migrationIntvl_); }
+        void SetMigrationIntvl(int n) { __atomic_store_n(&migrationIntvl_, n, __ATOMIC_RELAXED); }
+
+        //  NOTE adds counters of all local memory managers without lock
+        void CollectStats(fcm_stats& stats) const;
+        //  bytes cached by managers of core, read without lock
+        size_t GetCachedBytes(int core) const;
+        //  validate local memory managers which no thread owns
+        bool Validate();
+        //  release pages inside chunks cached by managers which no thread owns, returns bytes
+        size_t Purge(int indexMin, size_t pageSize);
+
+        //  NOTE called by pthread_atfork handlers in the order of mainPreFork
+        void PreFork() { pthread_mutex_lock(&mtx_); }
+        void PostForkParent() { pthread_mutex_unlock(&mtx_); }
+        //  only the thread which called fork survives, and survivor is its manager or nullptr
+        void PostForkChild(LocalMemoryManager *survivor);
 
     private:
+        LocalMemoryManager *allocLocked(int core);
+        void claimCacheBudget(LocalMemoryManager *m, size_t bytes, size_t keep);
+        size_t fairCacheBudget() const;
+
         pthread_mutex_t mtx_;
 
         int coreN_;
         int poolN_;
 
+        //  total bytes of all per-thread caches, 0 means unlimited
+        size_t cacheBudget_;
+        //  NOTE budgets of threads and this sum up to cacheBudget_
+        size_t unclaimedCacheBytes_;
+        int stealOffset_;
+        size_t flushEpoch_;
+        int migrationIntvl_;
+        CpuTopology* topo_;
+
         bool* poolFlags_;
-        MemoryLinkedListManager* memoryPools_;
+        //  NOTE defined in global_memory_manager.cpp, lists per local memory manager
+        struct ManagerLists;
+        ManagerLists* lists_;
         LocalMemoryManager* managerPools_;
 };
@@ -0,0 +1,214 @@
+/*
+ * Copyright 2017 Yamana Laboratory, Waseda University
+ * Supported by JST CREST Grant Number JPMJCR1503, Japan.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "heap_profiler.hpp"
+#include "mem_allocate.hpp"
+
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unwind.h>
+
+namespace {
+    struct Frames {
+        void** pcs;
+        int depth;
+    };
+
+    //  NOTE hidden, so that each module finds its own sections
+    extern "C" char __start_fcm_alloc_text[] __attribute__((visibility("hidden")));
+    extern "C" char __stop_fcm_alloc_text[] __attribute__((visibility("hidden")));
+    //  NOTE weak, as the section is empty if every LocalMemoryManager::Malloc is inlined
+    extern "C" char __start_fcm_alloc_inline_text[] __attribute__((visibility("hidden"), weak));
+    extern "C" char __stop_fcm_alloc_inline_text[] __attribute__((visibility("hidden"), weak));
+
+    //  whether pc is in a function of FCM_ALLOC_TEXT, not the module of the allocator,
+    //  which is the executable itself with libfcmalloc.a
+    bool isSelf(void* pc)
+    {
+        auto p = (char *)pc;
+        return (__start_fcm_alloc_text <= p && p < __stop_fcm_alloc_text)
+            || (__start_fcm_alloc_inline_text <= p && p < __stop_fcm_alloc_inline_text);
+    }
+
+    _Unwind_Reason_Code unwindFrame(struct _Unwind_Context* context, void* arg)
+    {
+        auto f = (Frames *)arg;
+        auto pc = (void *)_Unwind_GetIP(context);
+        if (pc == nullptr) {
+            return _URC_END_OF_STACK;
+        }
+        //  NOTE frames of malloc itself are skipped, so the caller of malloc comes first
+        if (f->depth == 0 && isSelf(pc)) {
+            return _URC_NO_REASON;
+        }
+        f->pcs[f->depth++] = pc;
+        return (f->depth < HeapProfiler::DEPTH_MAX) ? _URC_NO_REASON : _URC_END_OF_STACK;
+    }
+
+    //  NOTE the unwinder of libgcc reads .eh_frame, so frame pointers are not required
+    //  and no memory is allocated
+    FCM_ALLOC_TEXT int captureStack(void** pcs)
+    {
+        Frames f = { pcs, 0 };
+        _Unwind_Backtrace(unwindFrame, &f);
+        return f.depth;
+    }
+
+    void copyFile(int fd, const char* filename)
+    {
+        char buf[4096];
+        auto in = open(filename, O_RDONLY);
+        if (in == -1) {
+            return;
+        }
+        ssize_t len;
+        while ((len = read(in, buf, sizeof(buf))) > 0) {
+            write(fd, buf, len);
+        }
+        close(in);
+    }
+}
+
+void HeapProfiler::Init()
+{
+    mtx_ = PTHREAD_MUTEX_INITIALIZER;
+    auto rateStr = getenv("FCM_PROFILE_SAMPLE_RATE");
+    rate_ = (rateStr == nullptr) ? 0 : atoll(rateStr);
+    output_ = getenv("FCM_PROFILE_OUTPUT");
+    dumpSeq_ = 0;
+    buckets_ = nullptr;
+    bucketUsedN_ = 0;
+    if (rate_ > 0) {
+        //  NOTE pages of the table are touched when used
+        fcmalloc::TypeAwareMemAllocate(BUCKET_N, &buckets_);
+        memset(&buckets_[0], 0, sizeof(Bucket));
+    }
+}
+
+long HeapProfiler::nextSampleBytes(uint64_t& seed) const
+{
+    //  xorshift64
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    //  u is in (0, 1]
+    auto u = ((seed >> 11) + 1) * (1.0 / (1ull << 53));
+    auto bytes = -log(u) * rate_;
+    return (bytes < 1.0) ? 1 : (bytes > LONG_MAX / 2) ? LONG_MAX / 2 : (long)bytes;
+}
+
+uint32_t HeapProfiler::RecordAlloc(size_t size)
+{
+    void* pcs[DEPTH_MAX];
+    auto depth = captureStack(pcs);
+
+    uintptr_t hash = depth + 1;
+    for (auto i = 0; i < depth; ++i) {
+        hash = hash * 31 + (uintptr_t)pcs[i];
+        hash ^= hash >> 17;
+    }
+
+    mtxlock l(mtx_);
+    auto index = 0;
+    for (auto i = 0; depth > 0 && i < BUCKET_N - 1; ++i) {
+        auto j = 1 + (hash + i) % (BUCKET_N - 1);
+        auto& b = buckets_[j];
+        if (b.depth == 0) {
+            if (bucketUsedN_ >= BUCKET_N * 3 / 4) {
+                break;
+            }
+            ++bucketUsedN_;
+            b.hash = hash;
+            b.depth = depth;
+            memcpy(b.pcs, pcs, depth * sizeof(void*));
+            index = j;
+            break;
+        }
+        if (b.hash == hash && b.depth == depth && memcmp(b.pcs, pcs, depth * sizeof(void*)) == 0) {
+            index = j;
+            break;
+        }
+    }
+    auto& b = buckets_[index];
+    ++b.allocs;
+    b.allocBytes += size;
+    return index + 1;
+}
+
+void HeapProfiler::RecordFree(uint32_t id, size_t size)
+{
+    ASSERT(0 < id && id <= (uint32_t)BUCKET_N, "id = %u\n", id);
+    mtxlock l(mtx_);
+    auto& b = buckets_[id - 1];
+    ++b.frees;
+    b.freeBytes += size;
+}
+
+int HeapProfiler::Dump(const char* filename)
+{
+    if (rate_ == 0) {
+        return ENOENT;
+    }
+    auto fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        return errno;
+    }
+
+    mtxlock l(mtx_);
+    size_t inuse = 0, inuseBytes = 0, allocs = 0, allocBytes = 0;
+    for (auto i = 0; i < BUCKET_N; ++i) {
+        auto& b = buckets_[i];
+        if (b.allocs == 0) {
+            continue;
+        }
+        inuse      += b.allocs - b.frees;
+        inuseBytes += b.allocBytes - b.freeBytes;
+        allocs     += b.allocs;
+        allocBytes += b.allocBytes;
+    }
+    //  NOTE counts are of samples, and pprof scales them by the rate of heap_v2
+    myprintf(fd, "heap profile: %lu: %lu [%lu: %lu] @ heap_v2/%lu\n", inuse, inuseBytes, allocs, allocBytes, rate_);
+    for (auto i = 0; i < BUCKET_N; ++i) {
+        auto& b = buckets_[i];
+        if (b.allocs == 0) {
+            continue;
+        }
+        myprintf(fd, "%lu: %lu [%lu: %lu] @", b.allocs - b.frees, b.allocBytes - b.freeBytes, b.allocs, b.allocBytes);
+        for (auto j = 0; j < b.depth; ++j) {
+            myprintf(fd, " %x", b.pcs[j]);
+        }
+        myprintf(fd, "\n");
+    }
+    myprintf(fd, "\nMAPPED_LIBRARIES:\n");
+    copyFile(fd, "/proc/self/maps");
+    close(fd);
+    return 0;
+}
+
+int HeapProfiler::DumpNext()
+{
+    if (output_ == nullptr) {
+        return ENOENT;
+    }
+    char filename[PATH_MAX];
+    auto seq = __atomic_add_fetch(&dumpSeq_, 1, __ATOMIC_RELAXED);
+    snprintf(filename, sizeof(filename), "%s.%04d.heap", output_, seq);
+    return Dump(filename);
+}
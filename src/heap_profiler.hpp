@@ -0,0 +1,80 @@
+/*
+ * Copyright 2017 Yamana Laboratory, Waseda University
+ * Supported by JST CREST Grant Number JPMJCR1503, Japan.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "common.hpp"
+
+#include <climits>
+
+//  sampling heap profiler, a memory chunk is sampled about every FCM_PROFILE_SAMPLE_RATE bytes
+//  NOTE stacks are kept in a fixed table, so the profiler never calls malloc
+class HeapProfiler {
+    public:
+        static const int DEPTH_MAX = 32;
+        static const int BUCKET_N = 1 << 14;
+
+        void Init();
+        bool IsEnabled() const { return rate_ > 0; }
+        size_t GetSampleRate() const { return rate_; }
+
+        //  bytes until the next sample, which are geometrically distributed
+        long NextSampleBytes(uint64_t& seed) const
+        {
+            if (rate_ == 0) {
+                return LONG_MAX;
+            }
+            return nextSampleBytes(seed);
+        }
+
+        //  returns id of the stack, which is stored in the header of the sampled chunk
+        FCM_ALLOC_TEXT uint32_t RecordAlloc(size_t size);
+        void RecordFree(uint32_t id, size_t size);
+
+        //  write in the legacy heap profile format of pprof, returns 0 or errno value
+        int Dump(const char* filename);
+        //  dump to `FCM_PROFILE_OUTPUT.<seq>.heap`
+        int DumpNext();
+
+        //  NOTE called by pthread_atfork handlers in the order of mainPreFork
+        void PreFork() { pthread_mutex_lock(&mtx_); }
+        void PostForkParent() { pthread_mutex_unlock(&mtx_); }
+        void PostForkChild() { mtx_ = PTHREAD_MUTEX_INITIALIZER; }
+
+    private:
+        struct Bucket {
+            uintptr_t hash;
+            int depth;
+            void* pcs[DEPTH_MAX];
+            size_t allocs;
+            size_t allocBytes;
+            size_t frees;
+            size_t freeBytes;
+        };
+
+        long nextSampleBytes(uint64_t& seed) const;
+
+        pthread_mutex_t mtx_;
+
+        size_t rate_;
+        const char* output_;
+        int dumpSeq_;
+
+        //  NOTE bucket 0 is used for stacks which do not fit in the table
+        Bucket* buckets_;
+        int bucketUsedN_;
+};
@@ -17,31 +17,43 @@
 
 #include "init_term.hpp"
 
-void mainThreadLocalDummyFunc_();
-void threadLocalDummyFunc_();
+#include <pthread.h>
 
-void init_()
-{
-    mainThreadLocalDummyFunc_();
-    threadLocalDummyFunc_();
-}
-
-//  main thread
+//  process level initialization runs once, from the ELF constructor or from
+//  the first malloc/free called before it.
+//  thread level termination runs from the destructor of a pthread key.
 namespace {
-    typedef struct main_thread_caller {
-        main_thread_caller() { mainInit(); }
-        ~main_thread_caller() { mainTerm(); }
-    } main_thread_caller_t;
-}
+    pthread_once_t mainOnce = PTHREAD_ONCE_INIT;
+    pthread_key_t threadKey;
 
-void mainThreadLocalDummyFunc_() { static main_thread_caller_t _tmp; }
+    void threadKeyDestructor(void *)
+    {
+        threadTerm();
+    }
 
-//  thread local
-namespace {
-    typedef struct thread_local_caller {
-        thread_local_caller() { threadInit(); }
-        ~thread_local_caller() { threadTerm(); }
-    } thread_local_caller_t;
+    void mainInitOnce()
+    {
+        mainInit();
+        pthread_key_create(&threadKey, threadKeyDestructor);
+        pthread_atfork(mainPreFork, mainPostForkParent, mainPostForkChild);
+    }
+
+    __attribute__((constructor)) void mainConstructor()
+    {
+        pthread_once(&mainOnce, mainInitOnce);
+        mainStart();
+    }
+
+    __attribute__((destructor)) void mainDestructor()
+    {
+        mainTerm();
+    }
 }
 
-void threadLocalDummyFunc_() { thread_local static thread_local_caller_t _tmp; }
+void init_()
+{
+    pthread_once(&mainOnce, mainInitOnce);
+    threadInit();
+    //  NOTE value must be non-null to call the destructor
+    pthread_setspecific(threadKey, (void *)1);
+}
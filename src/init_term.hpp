@@ -17,10 +17,18 @@
 
 #pragma once
 
+//  NOTE called only on the slow path, when the calling thread has no LocalMemoryManager
 void init_();
 
 void mainInit();
+//  NOTE called once from the ELF constructor, so background threads can be started
+void mainStart();
 void mainTerm();
 
+//  pthread_atfork handlers
+void mainPreFork();
+void mainPostForkParent();
+void mainPostForkChild();
+
 void threadInit();
 void threadTerm();
@@ -0,0 +1,161 @@
+/*
+ * Copyright 2017 Yamana Laboratory, Waseda University
+ * Supported by JST CREST Grant Number JPMJCR1503, Japan.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "latency_recorder.hpp"
+#include "mem_allocate.hpp"
+
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <fcntl.h>
+
+namespace {
+    const char* pathNames[LATENCY_PATH_N] = {
+        "swap", "pool", "carve", "extend", "first_touch",
+    };
+}
+
+void LatencyHistogram::Merge(const LatencyHistogram& h)
+{
+    for (auto i = 0; i < BUCKET_N; ++i) {
+        counts_[i] += relaxedLoad(h.counts_[i]);
+    }
+    auto m = relaxedLoad(h.max_);
+    if (m > max_) {
+        max_ = m;
+    }
+}
+
+uint64_t LatencyHistogram::GetCount() const
+{
+    uint64_t n = 0;
+    for (auto i = 0; i < BUCKET_N; ++i) {
+        n += counts_[i];
+    }
+    return n;
+}
+
+uint64_t LatencyHistogram::upper(int b)
+{
+    if (b < (1 << SUB_BITS)) {
+        return b;
+    }
+    auto e = (b >> SUB_BITS) + SUB_BITS - 1;
+    auto sub = (uint64_t)(b & ((1 << SUB_BITS) - 1));
+    return (((1ull << SUB_BITS) + sub + 1) << (e - SUB_BITS)) - 1;
+}
+
+uint64_t LatencyHistogram::GetPercentile(double p) const
+{
+    auto n = GetCount();
+    if (n == 0) {
+        return 0;
+    }
+    auto rank = (uint64_t)(p * n);
+    uint64_t seen = 0;
+    for (auto i = 0; i < BUCKET_N; ++i) {
+        seen += counts_[i];
+        if (seen > rank) {
+            //  NOTE the max is exact, so it bounds the last bucket
+            auto u = upper(i);
+            return (u < max_) ? u : max_;
+        }
+    }
+    return max_;
+}
+
+void LatencyRecorder::Init(int numSets, int numRegions)
+{
+    setN_ = numSets;
+    regionN_ = numRegions;
+    chunkSets_ = nullptr;
+    regionSets_ = nullptr;
+    dumpSeq_ = 0;
+    output_ = getenv("FCM_LATENCY_OUTPUT");
+    if (output_ == nullptr) {
+        return;
+    }
+    //  NOTE mmap-ed memory is zero
+    fcmalloc::TypeAwareMemAllocate(setN_, &chunkSets_);
+    fcmalloc::TypeAwareMemAllocate(regionN_, &regionSets_);
+}
+
+void LatencyRecorder::dumpRow(int fd, const char* path, long index, const LatencyHistogram& h)
+{
+    auto n = h.GetCount();
+    if (n == 0) {
+        return;
+    }
+    myprintf(fd, "%12s", path);
+    if (index < 0) {
+        myprintf(fd, "%12s", "-");
+    }
+    else {
+        myprintf(fd, "%12lu", (size_t)1 << index);
+    }
+    myprintf(fd, "%12lu%10lu%10lu%10lu%10lu%12lu\n", (size_t)n,
+        (size_t)h.GetPercentile(0.5), (size_t)h.GetPercentile(0.9), (size_t)h.GetPercentile(0.99),
+        (size_t)h.GetPercentile(0.999), (size_t)h.GetMax());
+}
+
+//  NOTE histograms are merged one by one on the stack, so no lock and no malloc is needed
+int LatencyRecorder::Dump(const char* filename)
+{
+    if (chunkSets_ == nullptr) {
+        return ENOENT;
+    }
+    auto fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        return errno;
+    }
+    myprintf(fd, "%12s%12s%12s%10s%10s%10s%10s%12s\n", "path", "size", "count", "p50", "p90", "p99", "p99.9", "max");
+    for (auto p = 0; p < LATENCY_CHUNK_PATH_N; ++p) {
+        LatencyHistogram total;
+        memset(&total, 0, sizeof(total));
+        for (auto i = 0; i < MemorySizeManager::Size; ++i) {
+            LatencyHistogram h;
+            memset(&h, 0, sizeof(h));
+            for (auto j = 0; j < setN_; ++j) {
+                h.Merge(chunkSets_[j].hists[p][i]);
+            }
+            dumpRow(fd, pathNames[p], i, h);
+            total.Merge(h);
+        }
+        dumpRow(fd, pathNames[p], -1, total);
+    }
+    for (int p = LATENCY_CHUNK_PATH_N; p < LATENCY_PATH_N; ++p) {
+        LatencyHistogram h;
+        memset(&h, 0, sizeof(h));
+        for (auto j = 0; j < regionN_; ++j) {
+            h.Merge(regionSets_[j].Get((LatencyPath)p));
+        }
+        dumpRow(fd, pathNames[p], -1, h);
+    }
+    close(fd);
+    return 0;
+}
+
+int LatencyRecorder::DumpNext()
+{
+    if (output_ == nullptr) {
+        return ENOENT;
+    }
+    char filename[PATH_MAX];
+    auto seq = __atomic_add_fetch(&dumpSeq_, 1, __ATOMIC_RELAXED);
+    snprintf(filename, sizeof(filename), "%s.%04d.txt", output_, seq);
+    return Dump(filename);
+}
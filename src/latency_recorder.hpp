@@ -0,0 +1,106 @@
+/*
+ * Copyright 2017 Yamana Laboratory, Waseda University
+ * Supported by JST CREST Grant Number JPMJCR1503, Japan.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "common.hpp"
+#include "memory_size_manager.hpp"
+
+enum LatencyPath {
+    LATENCY_SWAP,           // mallocSlow served by swapping the free list
+    LATENCY_POOL,           // refill from the common memory pool, incl. misses
+    LATENCY_CARVE,          // carving fresh chunks, incl. mapping a batch
+    LATENCY_CHUNK_PATH_N,
+    LATENCY_EXTEND = LATENCY_CHUNK_PATH_N,  // mmap of MmapManager::ExtendBuffer
+    LATENCY_FIRST_TOUCH,    // MmapManager::FirstTouch of a region
+    LATENCY_PATH_N,
+};
+
+//  log-bucketed histogram of cycles, 4 buckets per power of 2 (error < 25%)
+//  NOTE written by one thread, and read by others without a lock
+class LatencyHistogram {
+    public:
+        static const int SUB_BITS = 2;
+        static const int EXP_N = 40;
+        static const int BUCKET_N = EXP_N << SUB_BITS;
+
+        void Record(uint64_t cycles)
+        {
+            auto b = bucket(cycles);
+            __atomic_store_n(&counts_[b], counts_[b] + 1, __ATOMIC_RELAXED);
+            if (cycles > max_) {
+                __atomic_store_n(&max_, cycles, __ATOMIC_RELAXED);
+            }
+        }
+        void Merge(const LatencyHistogram& h);
+
+        uint64_t GetCount() const;
+        uint64_t GetMax() const { return max_; }
+        //  upper bound of the bucket holding the p-th fraction, e.g. p = 0.99
+        uint64_t GetPercentile(double p) const;
+
+    private:
+        static int bucket(uint64_t v)
+        {
+            if (v < (1u << SUB_BITS)) {
+                return (int)v;
+            }
+            auto e = 63 - __builtin_clzll(v);
+            auto b = ((e - SUB_BITS + 1) << SUB_BITS) + (int)((v >> (e - SUB_BITS)) & ((1u << SUB_BITS) - 1));
+            return (b < BUCKET_N) ? b : BUCKET_N - 1;
+        }
+        static uint64_t upper(int b);
+
+        uint64_t counts_[BUCKET_N];
+        uint64_t max_;
+};
+
+//  latency of slow paths, enabled by FCM_LATENCY_OUTPUT
+//  each local memory manager records chunk paths to its own set, and each region of
+//  MmapManager records mmap paths under its lock. sets are merged when dumped
+//  NOTE histograms are mmap-ed at once and their pages are touched when used
+class LatencyRecorder {
+    public:
+        struct ChunkSet {
+            LatencyHistogram hists[LATENCY_CHUNK_PATH_N][MemorySizeManager::Size];
+        };
+        struct RegionSet {
+            LatencyHistogram hists[LATENCY_PATH_N - LATENCY_CHUNK_PATH_N];
+
+            LatencyHistogram& Get(LatencyPath p) { return hists[p - LATENCY_CHUNK_PATH_N]; }
+        };
+
+        void Init(int numSets, int numRegions);
+        bool IsEnabled() const { return chunkSets_ != nullptr; }
+        ChunkSet* GetChunkSet(int i) { return (chunkSets_ == nullptr) ? nullptr : &chunkSets_[i]; }
+        RegionSet* GetRegionSet(int i) { return (regionSets_ == nullptr) ? nullptr : &regionSets_[i]; }
+
+        //  write percentiles of merged histograms, returns 0 or errno value
+        int Dump(const char* filename);
+        //  dump to `FCM_LATENCY_OUTPUT.<seq>.txt`
+        int DumpNext();
+
+    private:
+        void dumpRow(int fd, const char* path, long index, const LatencyHistogram& h);
+
+        int setN_;
+        int regionN_;
+        ChunkSet* chunkSets_;
+        RegionSet* regionSets_;
+        const char* output_;
+        int dumpSeq_;
+};
@@ -17,73 +17,239 @@
 
 #include "local_memory_manager.hpp"
 #include "common_memory_pool.hpp"
+#include "global_memory_manager.hpp"
+#include "heap_profiler.hpp"
 #include "memory_size_manager.hpp"
+#include "probes.hpp"
 
 #include <string.h>
 
-void LocalMemoryManager::Init(int numCores, CommonMemoryPool& cmp, MemorySizeManager& msm) {
+void LocalMemoryManager::Init(int numCores, GlobalMemoryManager& g, CommonMemoryPool& cmp, MemorySizeManager& msm, HeapProfiler& prof) {
     core_ = 0;
     coreN_ = numCores;
     malloc_ = nullptr;
-    fcmalloc::TypeAwareMemAllocate(coreN_, &free_);
+    free_ = nullptr;
+    remotes_ = nullptr;
+    cachedBytes_ = 0;
+    maxCacheBytes_.store((size_t)-1, std::memory_order_relaxed);
+    memset(counters_, 0, MemorySizeManager::Size * sizeof(SizeCounters));
+    memset(allocsAtScavenge_, 0, MemorySizeManager::Size * sizeof(size_t));
+    memset(carveCur_, 0, MemorySizeManager::Size * sizeof(uintptr_t));
+    memset(carveEnd_, 0, MemorySizeManager::Size * sizeof(uintptr_t));
+    flushEpoch_ = 0;
+    reserve_.cur = 0;
+    reserve_.end = 0;
+    owner_ = nullptr;
+    slowCalls_ = 0;
+    migrations_ = 0;
+    migratedBytes_ = 0;
+    g_ = &g;
     cmp_ = &cmp;
     msm_ = &msm;
+    prof_ = &prof;
+    trace_ = nullptr;
+    traceRing_ = nullptr;
+    log_ = nullptr;
+    logRing_ = nullptr;
+    logLeft_ = LONG_MAX;
+    lat_ = nullptr;
+    //  NOTE managers are elements of an array, so neighbors start at other colors
+    colorSeq_ = (unsigned)((uintptr_t)this / sizeof(LocalMemoryManager));
+    sampleSeed_ = ((uint64_t)(uintptr_t)this * 0x9e3779b97f4a7c15ull) | 1;
+    sampleLeft_ = prof_->NextSampleBytes(sampleSeed_);
+}
+
+void LocalMemoryManager::SetFree(MemoryLinkedListManager* free, RemoteFreeList* remotes)
+{
+    free_ = free;
+    remotes_ = remotes;
+    for (auto i = 0; i < REMOTE_FREE_N; ++i) {
+        remotes_[i].core = -1;
+        remotes_[i].list.Init(coreN_);
+    }
 }
 
 //  NOTE index is log2(value)
 void LocalMemoryManager::swap(int index)
 {
-    ASSERT(free_[core_] != nullptr, "free list [core] is nullptr\n");
-    malloc_->Swap(free_[core_], index);
+    ASSERT(free_ != nullptr, "free list is nullptr\n");
+    malloc_->Swap(free_, index);
 }
 
-void* LocalMemoryManager::Malloc(size_t size)
+//  list for core when its home entry is used by another core
+MemoryLinkedListManager* LocalMemoryManager::remoteFree(int core)
 {
-    if (size == 0) {
-        return nullptr;
+    ASSERT(((0 <= core) && (core < coreN_) && (core != core_)), "core = %d\n", core);
+    auto home = core & (REMOTE_FREE_N - 1);
+    for (auto i = 0; i < REMOTE_FREE_N; ++i) {
+        auto& r = remotes_[(home + i) & (REMOTE_FREE_N - 1)];
+        if (r.core == core) {
+            return &r.list;
+        }
+        if (r.core == -1) {
+            r.core = core;
+            return &r.list;
+        }
     }
-    ASSERT(malloc_ != nullptr, "malloc list is nullptr\n");
+    //  NOTE all entries are used, so the home entry is evicted. the entry stays used,
+    //  so lookups of other cores still probe past it
+    auto& r = remotes_[home];
+    auto bytes = r.list.GetCachedBytes();
+    if (bytes > 0) {
+        cmp_->Free(&r.list, r.core);
+        cachedBytes_ -= bytes;
+    }
+    r.core = core;
+    return &r.list;
+}
 
+//  list holding memory chunks of core, or nullptr
+MemoryLinkedListManager* LocalMemoryManager::findFree(int core)
+{
+    if (core == core_) {
+        return free_;
+    }
+    for (auto i = 0; i < REMOTE_FREE_N; ++i) {
+        if (remotes_[i].core == core) {
+            return &remotes_[i].list;
+        }
+    }
+    return nullptr;
+}
+
+void* LocalMemoryManager::mallocSlow(int index, size_t size)
+{
+    auto epoch = g_->GetFlushEpoch();
+    if (epoch != flushEpoch_) {
+        flushEpoch_ = epoch;
+        Flush();
+    }
+    if (owner_ != nullptr) {
+        auto intvl = g_->GetMigrationIntvl();
+        if (intvl > 0 && ++slowCalls_ >= intvl) {
+            slowCalls_ = 0;
+            auto m = migrate();
+            if (m != this) {
+                return m->Malloc(size);
+            }
+        }
+    }
+    uint64_t t0 = (lat_ != nullptr) ? readCycles() : 0;
+    swap(index);
+    FCM_PROBE(swap, core_, index, malloc_->GetLength(index));
     auto ptr = malloc_->Malloc(size);
     if (ptr == nullptr) {
-        auto index = logarithm2(size);
-        swap(index);
-        ptr = malloc_->Malloc(size);
-        if (ptr == nullptr) {
-            ptr = cmp_->Malloc(malloc_, core_, size);
-            if (ptr == nullptr) {
-                auto n = msm_->GetMemorySize(index);
-                malloc_->Allocate(core_, size, n);
+        auto timed = (lat_ != nullptr || FCM_PROBE_ENABLED(refill));
+        uint64_t t1 = timed ? readCycles() : 0;
+        auto carved = false;
+        ptr = cmp_->Malloc(malloc_, core_, size);
+        uint64_t t2 = timed ? readCycles() : 0;
+        if (lat_ != nullptr) {
+            lat_->hists[LATENCY_POOL][index].Record(t2 - t1);
+        }
+        if (ptr != nullptr) {
+            ++counters_[index].refills;
+        }
+        else {
+            if (carve(index, size)) {
+                carved = true;
                 ptr = malloc_->Malloc(size);
-                if (ptr == nullptr) {
-                    errno = ENOMEM;
-                }
+            }
+            if (lat_ != nullptr) {
+                lat_->hists[LATENCY_CARVE][index].Record(readCycles() - t2);
+            }
+            if (ptr == nullptr) {
+                errno = ENOMEM;
+            }
+        }
+        //  refilled memory chunks are cached from now on
+        if (ptr != nullptr) {
+            cachedBytes_ += (malloc_->GetLength(index) + 1) << index;
+            if (FCM_PROBE_ENABLED(refill)) {
+                FCM_PROBE(refill, core_, index, malloc_->GetLength(index) + 1, carved, readCycles() - t1);
             }
         }
     }
-#ifdef DEBUG
-    InclCounter(ptr, size, true);
-#endif
+    else if (lat_ != nullptr) {
+        lat_->hists[LATENCY_SWAP][index].Record(readCycles() - t0);
+    }
+    if (ptr != nullptr) {
+        cachedBytes_ -= (size_t)1 << index;
+        ++counters_[index].allocs;
+        if ((sampleLeft_ -= (long)size) < 0) {
+            sample(MemUtil::PtrToList(ptr));
+        }
+        if (trace_ != nullptr) {
+            trace_->Record(traceRing_, TRACE_MALLOC, ptr, size, core_);
+        }
+        if (--logLeft_ == 0) {
+            logCounters();
+        }
+    }
     return ptr;
 }
 
+//  carve memory chunks of about CARVE_BYTES from the span of index into malloc_, and map
+//  a new batch when the span is used up. returns false if no memory is left
+//  NOTE headers are written only here, so pages of a batch are touched as chunks are used
+bool LocalMemoryManager::carve(int index, size_t size)
+{
+    auto totalSize = msm_->GetSlotSize(index);
+    if (carveEnd_[index] - carveCur_[index] < totalSize) {
+        auto n = msm_->GetMemorySize(index);
+        if (n <= 0) {
+            return false;
+        }
+        //  NOTE a colored span starts at a line of its own, so spans of other threads
+        //  and sizes do not begin on the same sets
+        size_t lead = 0;
+        if (msm_->IsColored(index)) {
+            lead = (colorSeq_++ * COLOR_SPAN_STEP * FCM_CACHE_LINE_SIZE) % MemorySizeManager::ColorPeriod;
+        }
+        //  the first header is shifted so that bodies are aligned
+        auto align = msm_->GetAlignment(index);
+        auto header = ALIGN(sizeof(MemoryLinkedList), 16);
+        lead += (align - header % align) % align;
+        auto p = mapMemoryLinkedList(core_, lead + totalSize * n, &reserve_);
+        if (p == nullptr) {
+            return false;
+        }
+        carveCur_[index] = (uintptr_t)p + lead;
+        carveEnd_[index] = (uintptr_t)p + lead + totalSize * n;
+        ++counters_[index].batches;
+        FCM_PROBE(batch, core_, index, lead + totalSize * n);
+    }
+    auto n = (carveEnd_[index] - carveCur_[index]) / totalSize;
+    auto pageN = (CARVE_BYTES + totalSize - 1) / totalSize;
+    if (n > pageN) {
+        n = pageN;
+    }
+    auto ret = carveMemoryLinkedList(coreN_, core_, size, totalSize, (void*)carveCur_[index], n);
+    carveCur_[index] += totalSize * n;
+    malloc_->append(index, ret.head, ret.last, n);
+    return true;
+}
+
 void* LocalMemoryManager::Realloc(void* ptr, size_t size)
 {
     if (ptr == nullptr) {
         return Malloc(size);
     }
 
-    auto m = (MemoryLinkedList *)((uintptr_t)ptr - sizeof(MemoryLinkedList));
-    m->Assert();
-    auto preSize = m->GetBodySize();
+    auto m = MemUtil::PtrToList(ptr);
+    //  NOTE an aligned block starts in the middle of the body
+    auto preSize = m->GetBodySize() - ((uintptr_t)ptr - (uintptr_t)m->GetBodyAddr());
     if (size <= preSize) {
         return ptr;
     }
 
+    //  NOTE Malloc may rebind the thread to another manager
+    auto owner = owner_;
     auto newPtr = Malloc(size);
     if(newPtr != nullptr) {
         memcpy(newPtr, ptr, preSize);
-        Free(ptr);
+        auto m = (owner == nullptr) ? this : *owner;
+        m->Free(ptr);
         return newPtr;
     }
     else {
@@ -91,58 +257,240 @@ void* LocalMemoryManager::Realloc(void* ptr, size_t size)
     }
 }
 
-void LocalMemoryManager::Free(void* ptr)
+void LocalMemoryManager::AllFreeToCommonMemoryPool()
 {
-    if (ptr == nullptr) {
-        return;
+    ASSERT(remotes_ != nullptr, "remote free lists are nullptr\n");
+
+    uint64_t t0 = FCM_PROBE_ENABLED(flush) ? readCycles() : 0;
+    size_t length = 0;
+    //  remote memory -> common memory pool
+    for (auto i = 0; i < REMOTE_FREE_N; ++i) {
+        auto& r = remotes_[i];
+        if (r.core == -1) {
+            continue;
+        }
+        auto bytes = r.list.GetCachedBytes();
+        if (bytes > 0) {
+            length += r.list.GetAllFreeLength();
+            cmp_->Free(&r.list, r.core);
+            cachedBytes_ -= bytes;
+        }
+        //  NOTE the table is emptied at once, so no lookup stops at an entry emptied in the middle
+        r.core = -1;
     }
-    ASSERT(free_ != nullptr, "free list is nullptr\n");
-    ASSERT(free_[core_] != nullptr, "free list [core] is nullptr\n");
+    if (FCM_PROBE_ENABLED(flush) && length > 0) {
+        FCM_PROBE(flush, core_, length, readCycles() - t0);
+    }
+}
 
-    auto core = MemUtil::PtrToCore(ptr);
-    free_[core]->Free(ptr);
-#ifdef DEBUG
-    InclCounter(ptr, MemUtil::PtrToSize(ptr), false);
-#endif
+void LocalMemoryManager::Join(int core, LocalMemoryManager* lm)
+{
+    auto lmFree = lm->findFree(core);
+    if (lmFree != nullptr) {
+        malloc_->Join(lmFree);
+    }
 }
 
-void LocalMemoryManager::AllFreeToCommonMemoryPool()
+//  NOTE lists of an unused manager are joined without counting, so count again before use
+void LocalMemoryManager::RecountCache()
 {
-    ASSERT(free_ != nullptr, "free list is nullptr\n");
-    ASSERT(free_[core_] != nullptr, "free list [core] is nullptr\n");
+    auto bytes = malloc_->GetCachedBytes() + free_->GetCachedBytes();
+    for (auto i = 0; i < REMOTE_FREE_N; ++i) {
+        bytes += remotes_[i].list.GetCachedBytes();
+    }
+    cachedBytes_ = bytes;
+}
 
-    //  remote memory -> common memory pool
-    for (auto i = 0; i < coreN_; ++i) {
-        if (i != core_) {
-            cmp_->Free(free_[i], i);
+//  return cached memory chunks to common memory pool until cachedBytes_ <= target
+//  if surplusOnly is true, chunks of each size used since the last scavenge are kept
+void LocalMemoryManager::release(size_t target, bool surplusOnly)
+{
+    MemoryLinkedListManager tmp;
+    tmp.Init(coreN_);
+
+    //  #malloc per size since the last scavenge
+    size_t mallocCnts[MemorySizeManager::Size];
+    for (auto i = 0; i < MemorySizeManager::Size; ++i) {
+        mallocCnts[i] = counters_[i].allocs - allocsAtScavenge_[i];
+    }
+
+    //  the coldest size comes first
+    int order[MemorySizeManager::Size - 1];
+    auto orderN = 0;
+    for (auto i = 0; i < MemorySizeManager::Size - 1; ++i) {
+        if (malloc_->GetLength(i) + free_->GetLength(i) == 0) {
+            continue;
+        }
+        auto j = orderN++;
+        for (; j > 0 && mallocCnts[order[j - 1]] > mallocCnts[i]; --j) {
+            order[j] = order[j - 1];
         }
+        order[j] = i;
+    }
+
+    for (auto k = 0; k < orderN && cachedBytes_ > target; ++k) {
+        auto index = order[k];
+        auto length = malloc_->GetLength(index) + free_->GetLength(index);
+        auto keep = 0ul;
+        if (surplusOnly) {
+            keep = (mallocCnts[index] < length) ? mallocCnts[index] : length;
+        }
+        auto n = length - keep;
+        auto needed = ((cachedBytes_ - target) + ((size_t)1 << index) - 1) >> index;
+        if (n > needed) {
+            n = needed;
+        }
+        if (n == 0) {
+            continue;
+        }
+        auto moved = free_->Move(&tmp, index, n);
+        if (moved < n) {
+            moved += malloc_->Move(&tmp, index, n - moved);
+        }
+        cachedBytes_ -= moved << index;
+    }
+
+    if (tmp.GetAllFreeLength() > 0) {
+        cmp_->Free(&tmp, core_);
     }
 }
 
-void LocalMemoryManager::Join(int core, LocalMemoryManager* lm)
+void LocalMemoryManager::Scavenge()
 {
-    auto lmFree = lm->free_[core];
-    malloc_->Join(lmFree);
+    //  remote memory is never reused by this thread
+    AllFreeToCommonMemoryPool();
+
+    auto budget = GetCacheBudget();
+    if (cachedBytes_ > budget / 2) {
+        release(budget / 2, true);
+    }
+    if (cachedBytes_ > budget / 2) {
+        //  every cached size is in use, so ask other threads for budget
+        g_->StealCacheBudget(this);
+        budget = GetCacheBudget();
+        if (cachedBytes_ > budget) {
+            release(budget / 2, false);
+        }
+    }
+    for (auto i = 0; i < MemorySizeManager::Size; ++i) {
+        allocsAtScavenge_[i] = counters_[i].allocs;
+    }
 }
 
-namespace MemUtil {
-    MemoryLinkedList* getList(uintptr_t ptr)
-    {
-        auto m = (MemoryLinkedList*)(ptr - sizeof(MemoryLinkedList));
-        ASSERT(m->CheckSignature(), "previous memory size is unknown\n");
-        m->Assert();
-        return m;
+void LocalMemoryManager::sample(MemoryLinkedList* m)
+{
+    //  NOTE malloc called while recording is not sampled
+    sampleLeft_ = LONG_MAX;
+    m->SetSample(prof_->RecordAlloc(m->GetBodySize()));
+    sampleLeft_ = prof_->NextSampleBytes(sampleSeed_);
+}
+
+void LocalMemoryManager::unsample(MemoryLinkedList* m)
+{
+    prof_->RecordFree(m->GetSample(), m->GetBodySize());
+    m->SetSample(0);
+}
+
+void LocalMemoryManager::Discard()
+{
+    malloc_->Init(coreN_);
+    free_->Init(coreN_);
+    for (auto i = 0; i < REMOTE_FREE_N; ++i) {
+        remotes_[i].core = -1;
+        remotes_[i].list.Init(coreN_);
     }
+    cachedBytes_ = 0;
+    memset(carveCur_, 0, MemorySizeManager::Size * sizeof(uintptr_t));
+    memset(carveEnd_, 0, MemorySizeManager::Size * sizeof(uintptr_t));
+    reserve_.cur = 0;
+    reserve_.end = 0;
+    owner_ = nullptr;
+}
+
+size_t LocalMemoryManager::Purge(int indexMin, size_t pageSize)
+{
+    auto bytes = malloc_->Purge(indexMin, pageSize) + free_->Purge(indexMin, pageSize);
+    for (auto i = 0; i < REMOTE_FREE_N; ++i) {
+        bytes += remotes_[i].list.Purge(indexMin, pageSize);
+    }
+    return bytes;
+}
+
+//  rebind the owner thread to a manager of the current core if it has moved
+LocalMemoryManager* LocalMemoryManager::migrate()
+{
+    auto cpu = g_->GetCurrentCore();
+    if (cpu < 0 || coreN_ <= cpu || cpu == core_) {
+        return this;
+    }
+    auto owner = owner_;
+    auto bytes = cachedBytes_;
+    //  NOTE this may be used by another thread after Rebind
+    owner_ = nullptr;
+    auto m = g_->Rebind(this, cpu);
+    if (m == this) {
+        owner_ = owner;
+        return this;
+    }
+    m->owner_ = owner;
+    *owner = m;
+    __atomic_store_n(&m->migrations_, m->migrations_ + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&m->migratedBytes_, m->migratedBytes_ + bytes, __ATOMIC_RELAXED);
+    return m;
+}
+
+void LocalMemoryManager::logCounters()
+{
+    size_t allocs = 0, frees = 0;
+    for (auto i = 0; i < MemorySizeManager::Size; ++i) {
+        allocs += counters_[i].allocs;
+        frees  += counters_[i].frees;
+    }
+    log_->Record(logRing_, core_, allocs, frees);
+    logLeft_ = log_->GetInterval();
+}
+
+void LocalMemoryManager::Flush()
+{
+    AllFreeToCommonMemoryPool();
+    RecountCache();
+    release(0, false);
+}
+
+size_t LocalMemoryManager::GetCachedLength(int index) const
+{
+    auto length = malloc_->GetLengthRelaxed(index) + free_->GetLengthRelaxed(index);
+    for (auto i = 0; i < REMOTE_FREE_N; ++i) {
+        length += remotes_[i].list.GetLengthRelaxed(index);
+    }
+    return length;
+}
+
+namespace MemUtil {
     size_t PtrToSize(void* ptr)
     {
-        auto m = getList((uintptr_t)ptr);
+        auto m = PtrToList(ptr);
         size_t size = m->GetBodySize();
         return size;
     }
     int PtrToCore(void* ptr)
     {
-        auto m = getList((uintptr_t)ptr);
+        auto m = PtrToList(ptr);
         auto core = m->GetCore();
         return core;
     }
 }
+
+bool LocalMemoryManager::Validate() const
+{
+    if (!malloc_->Validate(core_) || !free_->Validate(core_)) {
+        return false;
+    }
+    for (auto i = 0; i < REMOTE_FREE_N; ++i) {
+        auto& r = remotes_[i];
+        if (r.core == core_ || !r.list.Validate(r.core)) {
+            return false;
+        }
+    }
+    return true;
+}
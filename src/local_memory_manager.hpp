@@ -17,134 +17,275 @@
 
 #pragma once
 #include "common.hpp"
+#include "latency_recorder.hpp"
 #include "mem_allocate.hpp"
+#include "mem_logger.hpp"
 #include "memory_linked_list_manager.hpp"
+#include "mmap_manager.hpp"
+#include "trace_recorder.hpp"
 
-#ifdef DEBUG
-#include <ctime>
-#include <fcntl.h>
-// if you set `SIZE_BASED_LOG` 1, size-based log is enabled
-#define SIZE_BASED_LOG 0
-#endif
+#include <atomic>
+#include <climits>
 
 class CommonMemoryPool;
+class GlobalMemoryManager;
+class HeapProfiler;
 class MemorySizeManager;
 
-class LocalMemoryManager {
+//  #destination core whose remote frees are held at once, must be a power of 2
+//  NOTE a remote free to one more core returns a held list to the common memory pool
+#define REMOTE_FREE_N 8
+
+//  bytes of memory chunks whose headers are written at once, about a page
+#define CARVE_BYTES 4096
+
+//  lines between the starts of consecutive colored spans, odd so that every line is used
+#define COLOR_SPAN_STEP 17
+
+//  memory chunks freed by this thread and allocated on another core
+struct RemoteFreeList {
+    int core;  // -1 while unused
+    MemoryLinkedListManager list;
+};
+
+//  NOTE written by the owner thread only, and read by others with relaxedLoad
+struct SizeCounters {
+    size_t allocs;
+    size_t frees;
+    size_t refills;
+    size_t batches;
+    size_t remoteFrees;
+};
+
+namespace MemUtil {
+    //  body of the memory chunk which ptr is in
+    //  NOTE bodyAddr_ of a header is right before the body and points to it, and a block
+    //  of alignedMalloc has the body of its chunk there instead, so both are found by one load
+    inline void* PtrToBody(void* ptr)
+    {
+        return *(void**)((uintptr_t)ptr - sizeof(void*));
+    }
+    inline MemoryLinkedList* PtrToList(void* ptr)
+    {
+        auto m = (MemoryLinkedList*)((uintptr_t)PtrToBody(ptr) - sizeof(MemoryLinkedList));
+        ASSERT(m->CheckSignature(), "previous memory size is unknown\n");
+        m->Assert();
+        return m;
+    }
+    size_t PtrToSize(void* ptr);
+    int PtrToCore(void* ptr);
+}
+
+//  NOTE aligned so that managers of neighboring slots share no line
+class alignas(FCM_CACHE_LINE_SIZE) LocalMemoryManager {
     public:
-        void Init(int numCores, CommonMemoryPool& cmp, MemorySizeManager& msm);
+        void Init(int numCores, GlobalMemoryManager& g, CommonMemoryPool& cmp, MemorySizeManager& msm, HeapProfiler& prof);
 
         void SetMalloc(MemoryLinkedListManager* malloc)
         {
             malloc_ = malloc;
         }
-        void SetFree(int core, MemoryLinkedListManager* free)
+        //  free is for memory chunks of core_, remotes is REMOTE_FREE_N lists for other cores
+        void SetFree(MemoryLinkedListManager* free, RemoteFreeList* remotes);
+        //  NOTE ring is nullptr unless FCM_TRACE_OUTPUT is set
+        void SetTrace(TraceRecorder* trace, TraceRecorder::Ring* ring)
         {
-            ASSERT(((0 <= core) && (core < coreN_)), "core = %d\n", core);
-            free_[core] = free;
+            trace_ = (ring == nullptr) ? nullptr : trace;
+            traceRing_ = ring;
+        }
+        //  NOTE ring is nullptr unless the memory log is enabled
+        void SetMemLog(MemLogger* log, MemLogger::Ring* ring)
+        {
+            log_ = (ring == nullptr) ? nullptr : log;
+            logRing_ = ring;
+            logLeft_ = (ring == nullptr) ? LONG_MAX : log->GetInterval();
+        }
+        //  NOTE set is nullptr unless FCM_LATENCY_OUTPUT is set
+        void SetLatency(LatencyRecorder::ChunkSet* set)
+        {
+            lat_ = set;
         }
         void SetCore(int core)
         {
             ASSERT(((0 <= core) && (core < coreN_)), "core = %d\n", core);
             core_ = core;
-#ifdef DEBUG
-            ResetCounter();
-#endif
         }
 
         int GetCore() const
         {
             return core_;
         }
+        //  owner is the pointer of the thread to this, which is updated when the
+        //  thread is rebound to another core. nullptr means a borrowed manager
+        void SetOwner(LocalMemoryManager** owner)
+        {
+            owner_ = owner;
+        }
 
-        void *Malloc(size_t size);
-        void *Realloc(void *ptr, size_t size);
-        void Free(void *ptr);
+        //  NOTE fast path is inlined, refill is done in mallocSlow
+        FCM_ALLOC_INLINE_TEXT void *Malloc(size_t size)
+        {
+            ASSERT(size > 0, "size is 0\n");
+            ASSERT(malloc_ != nullptr, "malloc list is nullptr\n");
+            auto index = sizeToIndex(size);
+            auto m = malloc_->popFast(index);
+            if (m == nullptr) {
+                return mallocSlow(index, size);
+            }
+            cachedBytes_ -= (size_t)1 << index;
+            ++counters_[index].allocs;
+            if ((sampleLeft_ -= (long)size) < 0) {
+                sample(m);
+            }
+            auto ptr = m->GetBodyAddr();
+            if (trace_ != nullptr) {
+                trace_->Record(traceRing_, TRACE_MALLOC, ptr, size, core_);
+            }
+            if (--logLeft_ == 0) {
+                logCounters();
+            }
+            return ptr;
+        }
+        FCM_ALLOC_TEXT void *Realloc(void *ptr, size_t size);
+        void Free(void *ptr)
+        {
+            ASSERT(ptr != nullptr, "ptr is nullptr\n");
+            ASSERT(free_ != nullptr, "free list is nullptr\n");
+            auto m = MemUtil::PtrToList(ptr);
+            ASSERT((m->GetNext() == nullptr), "free next ptr must be null\n");
+            auto size = m->GetBodySize();
+            auto index = m->GetSizeIndex();
+            auto core = m->GetCore();
+            if (m->GetSample() != 0) {
+                unsample(m);
+            }
+            if (trace_ != nullptr) {
+                //  NOTE the body, which Malloc recorded even if ptr is an aligned block in it
+                trace_->Record(traceRing_, TRACE_FREE, m->GetBodyAddr(), size, core_);
+            }
+            if (core == core_) {
+                free_->pushFast(index, m);
+            }
+            else {
+                auto& r = remotes_[core & (REMOTE_FREE_N - 1)];
+                auto list = (r.core == core) ? &r.list : remoteFree(core);
+                list->pushFast(index, m);
+                ++counters_[index].remoteFrees;
+            }
+            cachedBytes_ += size;
+            ++counters_[index].frees;
+            if (--logLeft_ == 0) {
+                logCounters();
+            }
+            if (cachedBytes_ > maxCacheBytes_.load(std::memory_order_relaxed)) {
+                Scavenge();
+            }
+        }
         void AllFreeToCommonMemoryPool();
 
         size_t GetAllFreeLength() const
         {
-            auto cnt = 0u;
-            for (auto i = 0; i < coreN_; ++i) {
-                cnt += free_[i]->GetAllFreeLength();
+            auto cnt = free_->GetAllFreeLength();
+            for (auto i = 0; i < REMOTE_FREE_N; ++i) {
+                cnt += remotes_[i].list.GetAllFreeLength();
             }
             return cnt;
         }
 
         void Join(int core, LocalMemoryManager* lm);
 
-    private:
-        void swap(int index);
-
-#ifdef DEBUG
-#if SIZE_BASED_LOG
-        void ResetCounter()
+        //  NOTE budget is changed by GlobalMemoryManager only
+        void SetCacheBudget(size_t bytes)
         {
-            if(!numMalloc_) {
-                fcmalloc::TypeAwareMemAllocate(MemorySizeManager::Size, &numMalloc_);
-            }
-            memset(numMalloc_, 0, MemorySizeManager::Size * sizeof(size_t));
-            if(!numFree_) {
-                fcmalloc::TypeAwareMemAllocate(MemorySizeManager::Size, &numFree_);
-            }
-            memset(numFree_, 0, MemorySizeManager::Size * sizeof(size_t));
-            outIntvl_ = 1;
-            outFd_ = fdopen(core_);
+            maxCacheBytes_.store(bytes, std::memory_order_relaxed);
         }
-        void InclCounter(void* ptr, size_t size, bool isAlloc)
+        size_t GetCacheBudget() const
         {
-            if(ptr) {
-                auto index = logarithm2(size);
-                auto counter = ((isAlloc) ? numMalloc_ : numFree_) + index;
-                if(++*counter % outIntvl_ == 0) {
-                    auto now = (size_t)time(nullptr);
-                    myprintf(outFd_, "%u [%3d] size: %5u, #malloc: %5u, #free: %5u\n", now, core_, (1u << index), numMalloc_[index], numFree_[index]);
-                }
-            }
+            return maxCacheBytes_.load(std::memory_order_relaxed);
         }
-
-        size_t* numMalloc_;
-        size_t* numFree_;
-        size_t outIntvl_;
-        int outFd_;
-#else
-        void ResetCounter()
+        size_t GetCachedBytes() const
         {
-            numMalloc_ = 0;
-            numFree_ = 0;
-            auto intvlStr = getenv("FCM_MEM_LOG_INTVL");
-            outIntvl_ = (intvlStr == nullptr) ? 10000 : atoi(intvlStr);
-            outFd_ = fdopen(core_);
+            return cachedBytes_;
         }
-        void InclCounter(void* ptr, size_t size, bool isAlloc)
+        void RecountCache();
+        void Scavenge();
+        //  return all cached memory chunks to common memory pool
+        void Flush();
+        //  forget all cached memory chunks without touching them
+        void Discard();
+        //  release pages inside cached chunks, see MemoryLinkedListManager::Purge
+        //  NOTE called by the owner thread, or while no thread owns this
+        size_t Purge(int indexMin, size_t pageSize);
+
+        const SizeCounters& GetCounters(int index) const
         {
-            if(ptr) {
-                auto& counter = (isAlloc) ? numMalloc_ : numFree_;
-                if(++counter % outIntvl_ == 0) {
-                    auto now = (size_t)time(nullptr);
-                    myprintf(outFd_, "%u [%3d] #malloc: %5u, #free: %5u\n", now, core_, numMalloc_, numFree_);
-                }
-            }
+            return counters_[index];
         }
+        //  #rebinding to this from a manager of another core, and bytes flushed then
+        size_t GetMigrations() const { return relaxedLoad(migrations_); }
+        size_t GetMigratedBytes() const { return relaxedLoad(migratedBytes_); }
+        //  #free chunks of log2 index in all lists
+        size_t GetCachedLength(int index) const;
+        //  NOTE called by the owner thread, or while no thread owns this
+        bool Validate() const;
 
-        size_t numMalloc_;
-        size_t numFree_;
-        size_t outIntvl_;
-        int outFd_;
-#endif // SIZE_BASED_LOG
-#endif // DEBUG
+    private:
+        FCM_ALLOC_TEXT void *mallocSlow(int index, size_t size);
+        MemoryLinkedListManager* remoteFree(int core);
+        MemoryLinkedListManager* findFree(int core);
+        void swap(int index);
+        bool carve(int index, size_t size);
+        void release(size_t target, bool surplusOnly);
+        FCM_ALLOC_TEXT void sample(MemoryLinkedList* m);
+        void unsample(MemoryLinkedList* m);
+        void logCounters();
+        LocalMemoryManager* migrate();
 
+        //  NOTE fields used by the fast paths of Malloc and Free come first
         int core_;
         int coreN_;
 
         MemoryLinkedListManager* malloc_;
-        MemoryLinkedListManager** free_;
+        MemoryLinkedListManager* free_;
+        //  open addressing table keyed by core, whose entries are emptied all at once
+        RemoteFreeList* remotes_;
+
+        //  bytes of memory chunks held in malloc_, free_ and remotes_ lists
+        size_t cachedBytes_;
+        //  bytes until the next sample, decremented by every malloc
+        long sampleLeft_;
+        //  #malloc and #free until the next memory log record
+        long logLeft_;
+        TraceRecorder* trace_;
+        TraceRecorder::Ring* traceRing_;
+        //  NOTE written by other threads only when the budget moves
+        std::atomic<size_t> maxCacheBytes_;
+        SizeCounters counters_[MemorySizeManager::Size];
+        //  #malloc at the last scavenge, used to find cold sizes
+        size_t allocsAtScavenge_[MemorySizeManager::Size];
+        //  GlobalMemoryManager::GetFlushEpoch() at the last flush
+        size_t flushEpoch_;
+        //  rest of the last batch per size, which is not carved into chunks yet
+        uintptr_t carveCur_[MemorySizeManager::Size];
+        uintptr_t carveEnd_[MemorySizeManager::Size];
+        //  #colored span mapped, which decides the first line of the next one
+        unsigned colorSeq_;
+        //  mmap-ed memory which new batches are mapped from
+        MmapReservation reserve_;
+
+        LocalMemoryManager** owner_;
+        //  #mallocSlow since the last check of the current core
+        int slowCalls_;
+        size_t migrations_;
+        size_t migratedBytes_;
 
+        uint64_t sampleSeed_;
+
+        GlobalMemoryManager* g_;
         CommonMemoryPool* cmp_;
         MemorySizeManager* msm_;
+        HeapProfiler* prof_;
+        MemLogger* log_;
+        MemLogger::Ring* logRing_;
+        LatencyRecorder::ChunkSet* lat_;
 };
-
-namespace MemUtil {
-    size_t PtrToSize(void* ptr);
-    int PtrToCore(void* ptr);
-}
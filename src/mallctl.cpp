@@ -0,0 +1,437 @@
+/*
+ * Copyright 2017 Yamana Laboratory, Waseda University
+ * Supported by JST CREST Grant Number JPMJCR1503, Japan.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mallctl.hpp"
+
+#include "common_memory_pool.hpp"
+#include "global_memory_manager.hpp"
+#include "heap_profiler.hpp"
+#include "latency_recorder.hpp"
+#include "local_memory_manager.hpp"
+#include "memory_size_manager.hpp"
+#include "mmap_manager.hpp"
+
+#include "fcmalloc.h"
+
+#include <cerrno>
+#include <csignal>
+#include <cstddef>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+namespace {
+    Mallctl* signalCtl = nullptr;
+
+    //  NOTE stats are collected again for each name, so read "stats.*" sparingly
+    uint64_t sizeStat(Mallctl* ctl, long idx, size_t offset)
+    {
+        fcm_stats stats;
+        ctl->CollectStats(stats);
+        return *(uint64_t *)((char *)&stats.sizes[idx] + offset);
+    }
+
+    uint64_t totalStat(Mallctl* ctl, size_t offset)
+    {
+        fcm_stats stats;
+        ctl->CollectStats(stats);
+        return *(uint64_t *)((char *)&stats + offset);
+    }
+
+    bool parseLong(const char*& s, long& v)
+    {
+        if (*s < '0' || '9' < *s) {
+            return false;
+        }
+        v = 0;
+        while ('0' <= *s && *s <= '9') {
+            v = v * 10 + (*s - '0');
+            ++s;
+        }
+        return true;
+    }
+}
+
+#define SIZE_STAT(field) \
+    [](Context& c, size_t& v) { v = sizeStat(c.ctl, c.idx, offsetof(fcm_size_stats, field)); return true; }
+#define TOTAL_STAT(field) \
+    [](Context& c, size_t& v) { v = totalStat(c.ctl, offsetof(fcm_stats, field)); return true; }
+
+const Mallctl::Entry* Mallctl::entries(int& n)
+{
+    static const Entry table[] = {
+        { "opt.num_cores", Int,
+            [](Context& c, size_t& v) { v = c.ctl->coreN_; return true; }, nullptr },
+        { "opt.pool_size", Int,
+            [](Context& c, size_t& v) { v = c.ctl->g_->GetPoolN(); return true; }, nullptr },
+        { "opt.force_extend", Int,
+            [](Context& c, size_t& v) { v = c.ctl->mm_->GetForceMmapFlag(); return true; },
+            [](Context& c, size_t v) { c.ctl->mm_->SetForceMmapFlag(v != 0); return true; } },
+        { "opt.mmap_reserve", Size,
+            [](Context& c, size_t& v) { v = c.ctl->mm_->GetReserveSize(); return true; }, nullptr },
+        { "opt.migration_check", Int,
+            [](Context& c, size_t& v) { v = c.ctl->g_->GetMigrationIntvl(); return true; },
+            [](Context& c, size_t v) { c.ctl->g_->SetMigrationIntvl((int)v); return true; } },
+        { "opt.alignment", Size,
+            [](Context& c, size_t& v) { v = c.ctl->msm_->GetMaxAlignment(); return true; }, nullptr },
+        { "opt.coloring", Int,
+            [](Context& c, size_t& v) { v = c.ctl->msm_->GetColoring(); return true; }, nullptr },
+        //  total budget of thread caches, 0 disables scavenging
+        { "cache.max_total", Size,
+            [](Context& c, size_t& v) { v = c.ctl->g_->GetCacheBudget(); return true; },
+            [](Context& c, size_t v) { c.ctl->g_->SetCacheBudget(v); return true; } },
+        //  every thread flushes its cache at its next refill
+        { "cache.flush_all", Void, nullptr,
+            [](Context& c, size_t) { c.ctl->g_->RequestFlush(); return true; } },
+        //  release pages inside free chunks which no thread uses
+        { "pool.purge", Void, nullptr,
+            [](Context& c, size_t) { c.ctl->Purge(); return true; } },
+        { "thread.cache.bytes", Size,
+            [](Context& c, size_t& v) { v = (c.lp) ? c.lp->GetCachedBytes() : 0; return true; }, nullptr },
+        { "thread.cache.max", Size,
+            [](Context& c, size_t& v) { v = (c.lp) ? c.lp->GetCacheBudget() : 0; return true; }, nullptr },
+        { "thread.flush", Void, nullptr,
+            [](Context& c, size_t) { if (c.lp) { c.lp->Flush(); } return true; } },
+        { "thread.scavenge", Void, nullptr,
+            [](Context& c, size_t) { if (c.lp) { c.lp->Scavenge(); } return true; } },
+        { "size.#.nper", Int,
+            [](Context& c, size_t& v) { v = c.ctl->msm_->GetMemorySize(c.idx); return true; },
+            [](Context& c, size_t v) {
+                if (!c.ctl->msm_->IsValidMemorySize(c.idx, v)) {
+                    return false;
+                }
+                c.ctl->msm_->SetMemorySize(c.idx, (int)v);
+                return true;
+            } },
+        { "size.#.allocs", Size, SIZE_STAT(allocs), nullptr },
+        { "size.#.frees", Size, SIZE_STAT(frees), nullptr },
+        { "size.#.refills", Size, SIZE_STAT(refills), nullptr },
+        { "size.#.batches", Size, SIZE_STAT(batches), nullptr },
+        { "size.#.remote_frees", Size, SIZE_STAT(remote_frees), nullptr },
+        { "size.#.cached", Size, SIZE_STAT(cached_bytes), nullptr },
+        { "size.#.pooled", Size, SIZE_STAT(pooled_bytes), nullptr },
+        { "prof.sample_rate", Size,
+            [](Context& c, size_t& v) { v = c.ctl->prof_->GetSampleRate(); return true; }, nullptr },
+        //  dump to `FCM_PROFILE_OUTPUT.<seq>.heap`
+        { "prof.dump", Void, nullptr,
+            [](Context& c, size_t) { return c.ctl->prof_->DumpNext() == 0; } },
+        //  merge latency histograms and dump to `FCM_LATENCY_OUTPUT.<seq>.txt`
+        { "latency.dump", Void, nullptr,
+            [](Context& c, size_t) { return c.ctl->lat_->DumpNext() == 0; } },
+        //  check lists of the calling thread, unused threads and common memory pool
+        { "debug.validate", Void, nullptr,
+            [](Context& c, size_t) {
+                return (c.lp == nullptr || c.lp->Validate()) && c.ctl->g_->Validate() && c.ctl->cmp_->Validate();
+            } },
+        { "stats.mapped", Size, TOTAL_STAT(mapped_bytes), nullptr },
+        { "stats.carved", Size, TOTAL_STAT(carved_bytes), nullptr },
+        { "stats.live", Size, TOTAL_STAT(live_bytes), nullptr },
+        { "stats.cached", Size, TOTAL_STAT(cached_bytes), nullptr },
+        { "stats.pooled", Size, TOTAL_STAT(pooled_bytes), nullptr },
+        { "stats.migrations", Size, TOTAL_STAT(migrations), nullptr },
+        { "stats.migrated", Size, TOTAL_STAT(migrated_bytes), nullptr },
+        { "stats.purged", Size, TOTAL_STAT(purged_bytes), nullptr },
+        { "stats.num_threads", Int,
+            [](Context& c, size_t& v) { fcm_stats stats; c.ctl->CollectStats(stats); v = stats.num_threads; return true; }, nullptr },
+        //  NOTE region of the last core + 1 is for main thread
+        { "stats.core.#.mapped", Size,
+            [](Context& c, size_t& v) { v = c.ctl->mm_->GetMappedSize(c.idx); return true; }, nullptr },
+        { "stats.core.#.used", Size,
+            [](Context& c, size_t& v) { v = c.ctl->mm_->GetUsedSize(c.idx); return true; }, nullptr },
+    };
+    n = sizeof(table) / sizeof(table[0]);
+    return table;
+}
+
+#undef SIZE_STAT
+#undef TOTAL_STAT
+
+void Mallctl::Init(int numCores, GlobalMemoryManager& g, CommonMemoryPool& cmp, MmapManager& mm, MemorySizeManager& msm, HeapProfiler& prof, LatencyRecorder& lat)
+{
+    coreN_ = numCores;
+    g_ = &g;
+    cmp_ = &cmp;
+    mm_ = &mm;
+    msm_ = &msm;
+    prof_ = &prof;
+    lat_ = &lat;
+    purgedBytes_ = 0;
+
+    confFile_ = getenv("FCM_CONF_FILE");
+    auto intvlStr = getenv("FCM_CONF_INTVL");
+    confIntvl_ = (intvlStr == nullptr) ? 0 : atoi(intvlStr);
+}
+
+//  NOTE a name matches an entry if each `#` of the entry is a number in range
+const Mallctl::Entry* Mallctl::find(const char* name, long& idx)
+{
+    int n;
+    auto table = entries(n);
+    for (auto i = 0; i < n; ++i) {
+        auto p = table[i].name;
+        auto s = name;
+        idx = -1;
+        while (*p != '\0') {
+            if (*p == '#') {
+                if (!parseLong(s, idx)) {
+                    break;
+                }
+                ++p;
+            }
+            else if (*p == *s) {
+                ++p;
+                ++s;
+            }
+            else {
+                break;
+            }
+        }
+        if (*p == '\0' && *s == '\0') {
+            return &table[i];
+        }
+    }
+    return nullptr;
+}
+
+const Mallctl::Entry* Mallctl::lookup(const char* name, long& idx) const
+{
+    auto e = find(name, idx);
+    if (e != nullptr && idx != -1) {
+        //  "size.#" is log2 of size, and "stats.core.#" is region
+        auto idxMax = (strncmp(e->name, "size.", 5) == 0) ? MemorySizeManager::Size - 1 : mm_->GetRegionN();
+        if (idx >= idxMax) {
+            return nullptr;
+        }
+    }
+    return e;
+}
+
+int Mallctl::Call(LocalMemoryManager* lp, const char* name, void* oldp, size_t* oldlenp, void* newp, size_t newlen)
+{
+    if (name == nullptr) {
+        return EINVAL;
+    }
+    Context c = { this, lp, -1 };
+    auto e = lookup(name, c.idx);
+    if (e == nullptr) {
+        return ENOENT;
+    }
+
+    if (e->type == Void) {
+        if (oldp != nullptr || newp != nullptr) {
+            return EINVAL;
+        }
+        return (e->set(c, 0)) ? 0 : EFAULT;
+    }
+
+    auto len = (e->type == Int) ? sizeof(int) : sizeof(size_t);
+    if (oldp != nullptr) {
+        if (oldlenp == nullptr || *oldlenp != len || e->get == nullptr) {
+            return (e->get == nullptr) ? EPERM : EINVAL;
+        }
+        size_t v = 0;
+        if (!e->get(c, v)) {
+            return EFAULT;
+        }
+        if (e->type == Int) {
+            *(int *)oldp = (int)v;
+        }
+        else {
+            *(size_t *)oldp = v;
+        }
+    }
+    if (newp != nullptr) {
+        if (e->set == nullptr) {
+            return EPERM;
+        }
+        if (newlen != len) {
+            return EINVAL;
+        }
+        size_t v = (e->type == Int) ? (size_t)*(int *)newp : *(size_t *)newp;
+        if (!e->set(c, v)) {
+            return EINVAL;
+        }
+    }
+    return 0;
+}
+
+//  NOTE parsed without malloc, and `#` starts a comment
+int Mallctl::ApplyFile(const char* filename)
+{
+    const int bufSize = 4096;
+    char buf[bufSize + 1];
+    auto fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+        return 0;
+    }
+    auto len = read(fd, buf, bufSize);
+    close(fd);
+    if (len <= 0) {
+        return 0;
+    }
+    buf[len] = '\0';
+
+    auto applied = 0;
+    char* line = buf;
+    while (line != nullptr && *line != '\0') {
+        auto next = strchr(line, '\n');
+        if (next != nullptr) {
+            *next++ = '\0';
+        }
+        auto comment = strchr(line, '#');
+        if (comment != nullptr) {
+            *comment = '\0';
+        }
+        auto eq = strchr(line, '=');
+        if (eq != nullptr) {
+            //  trim `name = value`
+            auto nameEnd = eq;
+            while (nameEnd > line && (nameEnd[-1] == ' ' || nameEnd[-1] == '\t')) {
+                --nameEnd;
+            }
+            *nameEnd = '\0';
+            while (*line == ' ' || *line == '\t') {
+                ++line;
+            }
+            const char* value = eq + 1;
+            while (*value == ' ' || *value == '\t') {
+                ++value;
+            }
+            long v;
+            Context c = { this, nullptr, -1 };
+            auto e = lookup(line, c.idx);
+            if (e != nullptr && e->set != nullptr && parseLong(value, v)) {
+                //  NOTE an action like "prof.dump = 1" runs if value is not 0
+                if (e->type != Void || v != 0) {
+                    if (e->set(c, (size_t)v)) {
+                        ++applied;
+                    }
+                    else if (e->type != Void) {
+                        myprintf(stderr_fd, "fcmalloc: %s: invalid value of `%s`\n", filename, line);
+                    }
+                }
+            }
+            else {
+                myprintf(stderr_fd, "fcmalloc: %s: unknown or read-only setting `%s`\n", filename, line);
+            }
+        }
+        line = next;
+    }
+    return applied;
+}
+
+void Mallctl::onSignal(int)
+{
+    if (signalCtl != nullptr) {
+        sem_post(&signalCtl->confSem_);
+    }
+}
+
+void* Mallctl::watch(void* arg)
+{
+    auto ctl = (Mallctl *)arg;
+    time_t mtime = 0;
+    while (true) {
+        if (ctl->confIntvl_ > 0) {
+            timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_sec += ctl->confIntvl_;
+            auto r = sem_timedwait(&ctl->confSem_, &ts);
+            if (r != 0 && errno != ETIMEDOUT) {
+                continue;
+            }
+            if (r != 0) {
+                //  timed out, so apply only a modified file
+                struct stat st;
+                if (stat(ctl->confFile_, &st) != 0 || st.st_mtime == mtime) {
+                    continue;
+                }
+                mtime = st.st_mtime;
+            }
+        }
+        else if (sem_wait(&ctl->confSem_) != 0) {
+            continue;
+        }
+        ctl->ApplyFile(ctl->confFile_);
+    }
+    return nullptr;
+}
+
+void Mallctl::Start()
+{
+    if (confFile_ == nullptr) {
+        return;
+    }
+    ApplyFile(confFile_);
+
+    auto sigStr = getenv("FCM_CONF_SIGNAL");
+    auto sig = (sigStr == nullptr) ? 0 : atoi(sigStr);
+    if (sig <= 0 && confIntvl_ <= 0) {
+        return;
+    }
+    sem_init(&confSem_, 0, 0);
+    if (sig > 0) {
+        signalCtl = this;
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = onSignal;
+        sa.sa_flags = SA_RESTART;
+        sigemptyset(&sa.sa_mask);
+        sigaction(sig, &sa, nullptr);
+    }
+    pthread_t th;
+    if (pthread_create(&th, nullptr, watch, this) == 0) {
+        pthread_detach(th);
+    }
+}
+
+void Mallctl::CollectStats(fcm_stats& stats)
+{
+    memset(&stats, 0, sizeof(stats));
+    stats.num_cores = coreN_;
+    for (auto i = 0; i < mm_->GetRegionN(); ++i) {
+        stats.mapped_bytes += mm_->GetMappedSize(i);
+        stats.carved_bytes += mm_->GetUsedSize(i);
+    }
+    g_->CollectStats(stats);
+    cmp_->CollectStats(stats);
+    for (auto i = 0; i < FCM_NUM_SIZES - 1; ++i) {
+        auto& s = stats.sizes[i];
+        //  NOTE counters are not a snapshot, so #free may exceed #malloc
+        if (s.allocs > s.frees) {
+            stats.live_bytes += (s.allocs - s.frees) << i;
+        }
+        stats.cached_bytes += s.cached_bytes;
+        stats.pooled_bytes += s.pooled_bytes;
+    }
+    stats.purged_bytes = relaxedLoad(purgedBytes_);
+}
+
+size_t Mallctl::Purge()
+{
+    //  NOTE a body follows its header, so bodies of less than 2 pages
+    //  have no whole page inside
+    const size_t pageSize = sysconf(_SC_PAGESIZE);
+    auto indexMin = 0;
+    while (((size_t)1 << indexMin) < pageSize * 2) {
+        ++indexMin;
+    }
+    auto bytes = cmp_->Purge(indexMin, pageSize) + g_->Purge(indexMin, pageSize);
+    __atomic_add_fetch(&purgedBytes_, bytes, __ATOMIC_RELAXED);
+    return bytes;
+}
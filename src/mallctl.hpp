@@ -0,0 +1,90 @@
+/*
+ * Copyright 2017 Yamana Laboratory, Waseda University
+ * Supported by JST CREST Grant Number JPMJCR1503, Japan.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "common.hpp"
+
+#include <semaphore.h>
+
+struct fcm_stats;
+
+class CommonMemoryPool;
+class GlobalMemoryManager;
+class HeapProfiler;
+class LatencyRecorder;
+class LocalMemoryManager;
+class MemorySizeManager;
+class MmapManager;
+
+//  name based control, e.g. "stats.core.3.mapped" or "size.14.nper"
+//  NOTE a number in the name is matched by `#` in the table of mallctl.cpp
+class Mallctl {
+    public:
+        enum Type { Void, Int, Size };
+
+        struct Context {
+            Mallctl* ctl;
+            LocalMemoryManager* lp;  // the calling thread, may be nullptr
+            long idx;                // number in the name
+        };
+
+        struct Entry {
+            const char* name;
+            Type type;
+            bool (*get)(Context& c, size_t& v);
+            //  NOTE returns false if v is out of range, or an action fails
+            bool (*set)(Context& c, size_t v);
+        };
+
+        void Init(int numCores, GlobalMemoryManager& g, CommonMemoryPool& cmp, MmapManager& mm, MemorySizeManager& msm, HeapProfiler& prof, LatencyRecorder& lat);
+        //  start a thread which applies FCM_CONF_FILE when FCM_CONF_SIGNAL is caught
+        //  or the file is modified
+        void Start();
+
+        //  same as mallctl of jemalloc, returns 0 or errno value
+        int Call(LocalMemoryManager* lp, const char* name, void* oldp, size_t* oldlenp, void* newp, size_t newlen);
+        //  apply `name = value` lines of filename, returns #applied line
+        int ApplyFile(const char* filename);
+
+        void CollectStats(fcm_stats& stats);
+        //  release pages inside free chunks of 2 pages or more which no thread uses,
+        //  i.e. in the common memory pool and unused local memory managers, returns bytes
+        size_t Purge();
+
+    private:
+        static const Entry* entries(int& n);
+        static const Entry* find(const char* name, long& idx);
+        //  find and check the number in the name
+        const Entry* lookup(const char* name, long& idx) const;
+        static void* watch(void* arg);
+        static void onSignal(int sig);
+
+        int coreN_;
+        GlobalMemoryManager* g_;
+        CommonMemoryPool* cmp_;
+        MmapManager* mm_;
+        MemorySizeManager* msm_;
+        HeapProfiler* prof_;
+        LatencyRecorder* lat_;
+
+        size_t purgedBytes_;
+
+        const char* confFile_;
+        int confIntvl_;
+        sem_t confSem_;
+};
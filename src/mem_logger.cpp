@@ -0,0 +1,155 @@
+/*
+ * Copyright 2017 Yamana Laboratory, Waseda University
+ * Supported by JST CREST Grant Number JPMJCR1503, Japan.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mem_logger.hpp"
+
+#include <cstdio>
+#include <ctime>
+
+namespace {
+    const int DRAIN_MAX = 256;
+    //  NOTE a formatted record is shorter than LOG_LINE_MAX
+    const int LOG_LINE_MAX = 96;
+    const int BUF_SIZE = 16 * 1024;
+}
+
+void MemLogger::Init(int numCores, int numRings)
+{
+    mtx_ = PTHREAD_MUTEX_INITIALIZER;
+    coreN_ = numCores;
+    ringN_ = numRings;
+    rings_ = nullptr;
+    fds_ = nullptr;
+    closed_ = false;
+    dropped_ = 0;
+
+    auto intvlStr = getenv("FCM_MEM_LOG_INTVL");
+#ifdef DEBUG
+    intvl_ = (intvlStr == nullptr) ? 10000 : atol(intvlStr);
+#else
+    intvl_ = (intvlStr == nullptr) ? 0 : atol(intvlStr);
+#endif
+    if (intvl_ <= 0) {
+        intvl_ = 0;
+        return;
+    }
+
+    //  NOTE #record per ring
+    auto bufStr = getenv("FCM_MEM_LOG_BUFFER_SIZE");
+    size_t capacity = (bufStr == nullptr) ? 1024 : atoll(bufStr);
+    fcmalloc::TypeAwareMemAllocate(ringN_, &rings_);
+    for (auto i = 0; i < ringN_; ++i) {
+        rings_[i].Init(capacity);
+    }
+    fcmalloc::TypeAwareMemAllocate(coreN_, &fds_);
+    for (auto i = 0; i < coreN_; ++i) {
+        fds_[i] = 0;
+    }
+}
+
+void MemLogger::Record(Ring* ring, int core, size_t allocs, size_t frees)
+{
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    MemLogRecord r;
+    r.time = ts.tv_sec * 1000000000ull + ts.tv_nsec;
+    r.allocs = allocs;
+    r.frees = frees;
+    r.core = core;
+    r.reserved = 0;
+    if (!ring->Push(r)) {
+        __atomic_add_fetch(&dropped_, 1, __ATOMIC_RELAXED);
+    }
+}
+
+void MemLogger::flush(int core, const char* buf, size_t len)
+{
+    if (len == 0) {
+        return;
+    }
+    if (fds_[core] == 0) {
+        fds_[core] = fdopen(core);
+    }
+    if (fds_[core] > 0) {
+        write(fds_[core], buf, len);
+    }
+}
+
+size_t MemLogger::drain()
+{
+    MemLogRecord recs[DRAIN_MAX];
+    char buf[BUF_SIZE];
+    size_t total = 0;
+    mtxlock l(mtx_);
+    for (auto i = 0; i < ringN_; ++i) {
+        size_t n;
+        while ((n = rings_[i].Pop(recs, DRAIN_MAX)) > 0) {
+            size_t len = 0;
+            auto core = recs[0].core;
+            for (auto j = 0ul; j < n; ++j) {
+                auto& r = recs[j];
+                if (r.core != core || len + LOG_LINE_MAX > sizeof(buf)) {
+                    flush(core, buf, len);
+                    len = 0;
+                    core = r.core;
+                }
+                len += snprintf(buf + len, LOG_LINE_MAX, "%lu.%06lu [%3d] #malloc: %5lu, #free: %5lu\n",
+                        (unsigned long)(r.time / 1000000000), (unsigned long)(r.time % 1000000000 / 1000),
+                        r.core, (unsigned long)r.allocs, (unsigned long)r.frees);
+            }
+            flush(core, buf, len);
+            total += n;
+        }
+    }
+    return total;
+}
+
+void* MemLogger::writer(void* arg)
+{
+    auto log = (MemLogger *)arg;
+    const timespec intvl = { 0, 10000000 };
+    while (!relaxedLoad(log->closed_)) {
+        if (log->drain() == 0) {
+            nanosleep(&intvl, nullptr);
+        }
+    }
+    return nullptr;
+}
+
+void MemLogger::Start()
+{
+    if (rings_ == nullptr) {
+        return;
+    }
+    pthread_t th;
+    if (pthread_create(&th, nullptr, writer, this) == 0) {
+        pthread_detach(th);
+    }
+}
+
+void MemLogger::Term()
+{
+    if (rings_ == nullptr) {
+        return;
+    }
+    __atomic_store_n(&closed_, true, __ATOMIC_RELAXED);
+    drain();
+    auto dropped = GetDropped();
+    if (dropped > 0) {
+        myprintf(stderr_fd, "fcmalloc: %lu memory log records are dropped\n", dropped);
+    }
+}
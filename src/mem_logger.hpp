@@ -0,0 +1,76 @@
+/*
+ * Copyright 2017 Yamana Laboratory, Waseda University
+ * Supported by JST CREST Grant Number JPMJCR1503, Japan.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "common.hpp"
+#include "ring_buffer.hpp"
+
+struct MemLogRecord {
+    uint64_t time;      // CLOCK_REALTIME in ns
+    uint64_t allocs;    // #malloc of the local memory manager
+    uint64_t frees;     // #free of the local memory manager
+    int32_t core;
+    int32_t reserved;
+};
+
+//  logs #malloc/#free of each local memory manager every FCM_MEM_LOG_INTVL calls
+//  each local memory manager pushes binary records to its own ring, and a background
+//  thread formats them and writes `FCM_LOG_PREFIX_<core>.log` in batches
+class MemLogger {
+    public:
+        typedef RingBuffer<MemLogRecord> Ring;
+
+        void Init(int numCores, int numRings);
+        bool IsEnabled() const { return rings_ != nullptr; }
+        Ring* GetRing(int i) { return (rings_ == nullptr) ? nullptr : &rings_[i]; }
+        //  #malloc and #free between records
+        long GetInterval() const { return intvl_; }
+
+        //  NOTE never waits for the writer, the record is dropped if the ring is full
+        void Record(Ring* ring, int core, size_t allocs, size_t frees);
+
+        //  start the writer thread
+        void Start();
+        //  write all records
+        void Term();
+
+        size_t GetDropped() const { return relaxedLoad(dropped_); }
+
+        //  NOTE called by pthread_atfork handlers in the order of mainPreFork
+        void PreFork() { pthread_mutex_lock(&mtx_); }
+        void PostForkParent() { pthread_mutex_unlock(&mtx_); }
+        //  NOTE the writer thread is not restarted, so records of the child are
+        //  written at exit, and dropped if the ring is full until then
+        void PostForkChild() { mtx_ = PTHREAD_MUTEX_INITIALIZER; }
+
+    private:
+        static void* writer(void* arg);
+        size_t drain();
+        void flush(int core, const char* buf, size_t len);
+
+        pthread_mutex_t mtx_;
+
+        int coreN_;
+        int ringN_;
+        Ring* rings_;
+        //  NOTE files are opened by the writer when the first record of the core comes
+        int* fds_;
+        long intvl_;
+        bool closed_;
+        size_t dropped_;
+};
@@ -18,41 +18,26 @@
 #include "memory_linked_list.hpp"
 #include "mmap_manager.hpp"
 
+#include <cstddef>
+
 extern MmapManager mm;
 
 void MemoryLinkedList::Init(size_t numCores)
 {
+    static_assert(offsetof(MemoryLinkedList, bodyAddr_) + sizeof(void *) == sizeof(MemoryLinkedList),
+            "MemUtil::PtrToBody reads bodyAddr_ right before the body");
     dummy_space_ = SIGNATURE;
     coreN_       = numCores;
+    sample_      = 0;
     core_        = -1;
     size_        = 0;
     next_        = nullptr;
     bodyAddr_    = nullptr;
 }
 
-bool MemoryLinkedList::CheckSignature() const
-{
-    //Debug("[mem pre check SIG]\n");
-    return (dummy_space_ == SIGNATURE);
-}
-
-void MemoryLinkedList::Assert() const
-{
-    //Debug("[mem pre assert]\n");
-    //Debug("[mem assert] ptr = %p, SIG = %x, size = %u, core = %u\n", this, dummy_space_, size_, core_);
-
-    ASSERT((dummy_space_ == SIGNATURE), "sig check fault: SIG = %u\n", dummy_space_);
-    ASSERT(((0 <= core_) && (core_ < coreN_)), "core = %u\n", core_);
-    ASSERT((size_ > 0), "size is 0\n");
-    ASSERT((bodyAddr_ != nullptr), "pointer is null\n");
-}
-
-MemoryLinkedListResult allocateMemoryLinkedList(size_t numCores, size_t core, size_t size, size_t n)
+size_t memoryLinkedListTotalSize(size_t size)
 {
-    ASSERT(((0 <= core) && (core < numCores)), "core = %u\n", core);
     ASSERT((size > 0), "size is 0\n");
-    ASSERT((n > 0), "n is 0\n");
-
     size = roundup_powerof2(size);
     //  size==1, 2, 4 -> 8B align.
     if (size < 8) size = 8;
@@ -64,20 +49,31 @@ MemoryLinkedListResult allocateMemoryLinkedList(size_t numCores, size_t core, si
     OVERFLOW_ADD_ASSERT(size, ALIGN(sizeof(MemoryLinkedList), 16));
     auto totalSize = size + ALIGN(sizeof(MemoryLinkedList), 16);
     //  size==1, 2, 4, 8 -> 16B align.
-    totalSize = ALIGN(totalSize, 16);
+    return ALIGN(totalSize, 16);
+}
 
+void* mapMemoryLinkedList(size_t core, size_t bytes, MmapReservation* r)
+{
+    ASSERT((bytes > 0), "bytes is 0\n");
     auto pageSize = mm.GetPageSize();
-    auto mmapSize = ALIGN(totalSize * n, pageSize);
+    auto mmapSize = ALIGN(bytes, pageSize);
 
     ASSERT(ALIGN_CHECK(mmapSize, pageSize), "mmap pagesize falt.\n");
 
-    auto p = mm.Malloc(core, mmapSize);
-
-    auto bodySize = size;
+    return (r == nullptr) ? mm.Malloc(core, mmapSize) : mm.Malloc(core, mmapSize, *r);
+}
 
-    auto buffer = p;
+MemoryLinkedListResult carveMemoryLinkedList(size_t numCores, size_t core, size_t size, size_t totalSize, void* buffer, size_t n)
+{
+    ASSERT(((0 <= core) && (core < numCores)), "core = %u\n", core);
+    ASSERT((n > 0), "n is 0\n");
     ASSERT(ALIGN_CHECK(buffer, 16), "buffer = %p, buffer %% 16 = %ld\n", buffer, (uintptr_t)buffer % 16);
+    ASSERT(totalSize >= memoryLinkedListTotalSize(size), "totalSize = %lu\n", totalSize);
 
+    auto bodySize = roundup_powerof2(size);
+    if (bodySize < 8) bodySize = 8;
+
+    auto p = buffer;
     MemoryLinkedList* head = nullptr;
     MemoryLinkedList* pre  = nullptr;
     for (auto i = 0u; i < n; ++i) {
@@ -101,3 +97,17 @@ MemoryLinkedListResult allocateMemoryLinkedList(size_t numCores, size_t core, si
     auto last = pre;
     return MemoryLinkedListResult{ p, head, last };
 }
+
+MemoryLinkedListResult allocateMemoryLinkedList(size_t numCores, size_t core, size_t size, size_t n, MmapReservation* r)
+{
+    ASSERT(((0 <= core) && (core < numCores)), "core = %u\n", core);
+    ASSERT((size > 0), "size is 0\n");
+    ASSERT((n > 0), "n is 0\n");
+
+    auto totalSize = memoryLinkedListTotalSize(size);
+    auto p = mapMemoryLinkedList(core, totalSize * n, r);
+    if (p == nullptr) {
+        return MemoryLinkedListResult{ nullptr, nullptr, nullptr };
+    }
+    return carveMemoryLinkedList(numCores, core, size, totalSize, p, n);
+}
@@ -46,16 +46,32 @@ class MemoryLinkedList {
         void SetNext(MemoryLinkedList *next) { next_ = next; }
         void SetBodyAddr(void *bodyAddr) { bodyAddr_ = bodyAddr; }
 
-        bool CheckSignature() const;
+        bool CheckSignature() const
+        {
+            return (dummy_space_ == SIGNATURE);
+        }
+
+        //  NOTE non-zero if the chunk is sampled by HeapProfiler
+        uint32_t GetSample() const { return sample_; }
+        void SetSample(uint32_t sample) { sample_ = sample; }
 
         int GetCore() const { return core_; }
         MemoryLinkedList *GetNext() const { return next_; }
         void *GetBodyAddr() const { return bodyAddr_; }
 
-        void Assert() const;
+        //  NOTE inline so that release builds have no call here
+        void Assert() const
+        {
+            ASSERT((dummy_space_ == SIGNATURE), "sig check fault: SIG = %u\n", dummy_space_);
+            ASSERT(((0 <= core_) && (core_ < coreN_)), "core = %u\n", core_);
+            ASSERT((size_ > 0), "size is 0\n");
+            ASSERT((bodyAddr_ != nullptr), "pointer is null\n");
+        }
         bool IsLast() const { return (next_ == nullptr); }
         size_t GetHeaderSize() const { return ALIGN(sizeof(MemoryLinkedList), 16); }
         size_t GetBodySize() const { return size_; }
+        //  NOTE body size is a power of 2, so this equals logarithm2(size_)
+        int GetSizeIndex() const { return __builtin_ctzl(size_); }
         size_t GetTotalSize() const
         {
             //  check overflow
@@ -67,9 +83,11 @@ class MemoryLinkedList {
         // NOTE sizeof()で取得した際に16B ALIGNにしたいので、サイズに注意
         size_t dummy_space_;     // Verification Code Space
         size_t core_;            // allocated core id
-        size_t coreN_;
+        uint32_t coreN_;
+        uint32_t sample_;        // stack id of HeapProfiler
         size_t size_;            // max raw data size
         MemoryLinkedList *next_; //  linked list pointer
+        //  NOTE must be the last field, see MemUtil::PtrToBody
         void *bodyAddr_;         // raw data
 };
 
@@ -79,4 +97,14 @@ struct MemoryLinkedListResult {
     MemoryLinkedList *last;
 };
 
-MemoryLinkedListResult allocateMemoryLinkedList(size_t numCores, size_t core, size_t size, size_t n);
+struct MmapReservation;
+
+//  bytes of a memory chunk of size, incl. the header
+size_t memoryLinkedListTotalSize(size_t size);
+//  map bytes for chunks without touching them, returns nullptr if no memory is left
+void* mapMemoryLinkedList(size_t core, size_t bytes, MmapReservation* r = nullptr);
+//  write headers of n chunks of size from buffer, and link them in order
+//  NOTE totalSize is the stride of chunks, at least memoryLinkedListTotalSize(size)
+MemoryLinkedListResult carveMemoryLinkedList(size_t numCores, size_t core, size_t size, size_t totalSize, void* buffer, size_t n);
+//  NOTE memory is carved from r if it is not nullptr, and head is nullptr if no memory is left
+MemoryLinkedListResult allocateMemoryLinkedList(size_t numCores, size_t core, size_t size, size_t n, MmapReservation* r = nullptr);
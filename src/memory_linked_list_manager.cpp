@@ -17,7 +17,9 @@
 
 #include "memory_linked_list_manager.hpp"
 
-void MemoryLinkedListManager::append(int index, MemoryLinkedList *thead, MemoryLinkedList *tlast)
+#include <sys/mman.h>
+
+void MemoryLinkedListManager::append(int index, MemoryLinkedList *thead, MemoryLinkedList *tlast, size_t n)
 {
     ASSERT(thead != nullptr, "thead pointer must not be nullptr\n");
     ASSERT(tlast != nullptr, "tlast pointer must not be nullptr\n");
@@ -43,6 +45,7 @@ void MemoryLinkedListManager::append(int index, MemoryLinkedList *thead, MemoryL
         last->SetNext(thead);
         last = tlast;
     }
+    lengths_[index] += n;
 
     if (lengthAssertFlag) {
         auto postLength   = head->GetLength();
@@ -54,19 +57,24 @@ void MemoryLinkedListManager::append(int index, MemoryLinkedList *thead, MemoryL
     ASSERT(last->GetNext() == nullptr, "last next pointer must be nullptr\n");
 }
 
-void MemoryLinkedListManager::Allocate(int core, size_t size, size_t n)
+void MemoryLinkedListManager::Allocate(int core, size_t size, size_t n, MmapReservation* r)
 {
     auto index = logarithm2(size);
-    auto ret = allocateMemoryLinkedList(coreN_, core, size, n);
-    append(index, ret.head, ret.last);
+    auto ret = allocateMemoryLinkedList(coreN_, core, size, n, r);
+    if (ret.head == nullptr) {
+        return;
+    }
+    append(index, ret.head, ret.last, n);
 }
 
-MemoryLinkedList *MemoryLinkedListManager::popN(int index, int n)
+//  pop at most n memory chunks as one linked list [ret, rlast]
+MemoryLinkedList *MemoryLinkedListManager::popN(int index, size_t n, MemoryLinkedList *&rlast, size_t &cnt)
 {
     MemoryLinkedList *&head = heads_[index];
-    MemoryLinkedList *&last = lasts_[index];
 
-    if (head == nullptr || last == nullptr) {
+    cnt = 0;
+    rlast = nullptr;
+    if (head == nullptr || n == 0) {
         errno = ENOMEM;
         return nullptr;
     }
@@ -74,71 +82,62 @@ MemoryLinkedList *MemoryLinkedListManager::popN(int index, int n)
 
     auto ret = head;
 
-    auto newHead = head->GetNext();
-    auto tmp = newHead;
-    for (auto i = 1; i < n && tmp->GetNext() != nullptr; ++i) {
+    auto tmp = head;
+    cnt = 1;
+    while (cnt < n && tmp->GetNext() != nullptr) {
         tmp = tmp->GetNext();
+        ++cnt;
     }
-    auto newLast = tmp;
-    head = newLast->GetNext();
-    newLast->SetNext(nullptr);
+    rlast = tmp;
+    head = rlast->GetNext();
+    rlast->SetNext(nullptr);
     if (head != nullptr) {
         head->Assert();
     }
-    else {
-        last = nullptr;
-    }
+    ASSERT(lengths_[index] >= cnt, "length = %ld, cnt = %ld\n", lengths_[index], cnt);
+    lengths_[index] -= cnt;
     return ret;
 }
 
-MemoryLinkedList *MemoryLinkedListManager::pop(int index)
+size_t MemoryLinkedListManager::Move(MemoryLinkedListManager *dst, int index, size_t n)
 {
-    MemoryLinkedList *&head = heads_[index];
-    MemoryLinkedList *&last = lasts_[index];
-
-    if (head == nullptr || last == nullptr) {
-        errno = ENOMEM;
-        return nullptr;
+    ASSERT(dst != nullptr, "dst is nullptr\n");
+    MemoryLinkedList *last;
+    size_t cnt;
+    auto head = popN(index, n, last, cnt);
+    if (head != nullptr) {
+        dst->append(index, head, last, cnt);
     }
-    head->Assert();
-
-    auto ret = head;
+    return cnt;
+}
 
-    auto newHead = head->GetNext();
-    head->SetNext(nullptr);
-    if (newHead != nullptr) {
-        newHead->Assert();
-    }
-    else {
-        last = nullptr;
+MemoryLinkedList *MemoryLinkedListManager::pop(int index)
+{
+    auto ret = popFast(index);
+    if (ret == nullptr) {
+        errno = ENOMEM;
     }
-    head = newHead;
     return ret;
 }
 
 void *MemoryLinkedListManager::Malloc(size_t size)
 {
-    int index = logarithm2(size);
-    MemoryLinkedList *&head = heads_[index];
-    MemoryLinkedList *&last = lasts_[index];
-
-    if (head == nullptr || last == nullptr) {
-        errno = ENOMEM;
+    int index = sizeToIndex(size);
+    auto m = pop(index);
+    if (m == nullptr) {
         return nullptr;
     }
-    head->Assert();
 
-    auto ptr = head->GetBodyAddr();
+    auto ptr = m->GetBodyAddr();
     ASSERT((ptr != nullptr), "malloced addr must not be null\n");
-    ASSERT((size <= head->GetBodySize()), "size = %ld, malloced_size = %ld\n", size, head->GetBodySize());
-
-    auto newHead = pop(index);
+    ASSERT((size <= m->GetBodySize()), "size = %ld, malloced_size = %ld\n", size, m->GetBodySize());
     return ptr;
 }
 
 void MemoryLinkedListManager::push(int index, MemoryLinkedList *next)
 {
-    append(index, next, next);
+    ASSERT(next->GetNext() == nullptr, "push next ptr must be null\n");
+    pushFast(index, next);
 }
 
 void MemoryLinkedListManager::Free(void *ptr)
@@ -151,10 +150,7 @@ void MemoryLinkedListManager::Free(void *ptr)
     m->Assert();
     ASSERT((m->GetNext() == nullptr), "free next ptr must be null\n");
 
-    auto size = m->GetBodySize();
-    auto index = logarithm2(size);
-
-    push(index, m);
+    push(m->GetSizeIndex(), m);
     return;
 }
 
@@ -162,9 +158,50 @@ void MemoryLinkedListManager::Join(MemoryLinkedListManager *lm)
 {
     for (auto i = 0; i < MemorySizeManager::Size; ++i) {
         if (lm->heads_[i] != nullptr) {
-            append(i, lm->heads_[i], lm->lasts_[i]);
+            append(i, lm->heads_[i], lm->lasts_[i], lm->lengths_[i]);
             lm->heads_[i] = nullptr;
             lm->lasts_[i] = nullptr;
+            lm->lengths_[i] = 0;
+        }
+    }
+}
+
+size_t MemoryLinkedListManager::Purge(int indexMin, size_t pageSize)
+{
+    size_t bytes = 0;
+    for (auto i = indexMin; i < MemorySizeManager::Size - 1; ++i) {
+        for (auto m = heads_[i]; m != nullptr; m = m->GetNext()) {
+            auto body = (uintptr_t)m->GetBodyAddr();
+            auto begin = ALIGN(body, pageSize);
+            auto end = (body + m->GetBodySize()) / pageSize * pageSize;
+            if (begin < end && madvise((void *)begin, end - begin, MADV_DONTNEED) == 0) {
+                bytes += end - begin;
+            }
+        }
+    }
+    return bytes;
+}
+
+bool MemoryLinkedListManager::Validate(int core) const
+{
+    for (auto i = 0; i < MemorySizeManager::Size; ++i) {
+        auto cnt = 0ul;
+        MemoryLinkedList *last = nullptr;
+        for (auto m = heads_[i]; m != nullptr; m = m->GetNext()) {
+            if (!m->CheckSignature() || m->GetSizeIndex() != i || (core >= 0 && m->GetCore() != core)) {
+                myprintf(stderr_fd, "fcmalloc: broken chunk %p in list of 2^%d\n", m, i);
+                return false;
+            }
+            //  NOTE stop at a cycle
+            if (++cnt > lengths_[i]) {
+                break;
+            }
+            last = m;
+        }
+        if (cnt != lengths_[i] || (cnt > 0 && (last != lasts_[i] || last->GetNext() != nullptr))) {
+            myprintf(stderr_fd, "fcmalloc: list of 2^%d has %lu chunks until %x, length = %lu, last = %x\n", i, cnt, last, lengths_[i], lasts_[i]);
+            return false;
         }
     }
+    return true;
 }
@@ -30,14 +30,41 @@ class MemoryLinkedListManager {
             for (auto i = 0; i < MemorySizeManager::Size; ++i) {
                 heads_[i] = nullptr;
                 lasts_[i] = nullptr;
+                lengths_[i] = 0;
             }
         }
-        void append(int index, MemoryLinkedList *head, MemoryLinkedList *last);
+        //  NOTE lists are LIFO, and lasts_[index] is valid only while heads_[index] != nullptr.
+        //  so the last chunk is touched only by append/Join splices.
+        MemoryLinkedList *popFast(int index)
+        {
+            auto head = heads_[index];
+            if (head != nullptr) {
+                head->Assert();
+                heads_[index] = head->GetNext();
+                head->SetNext(nullptr);
+                --lengths_[index];
+            }
+            return head;
+        }
+        void pushFast(int index, MemoryLinkedList *m)
+        {
+            auto head = heads_[index];
+            if (head == nullptr) {
+                lasts_[index] = m;
+            }
+            m->SetNext(head);
+            heads_[index] = m;
+            ++lengths_[index];
+        }
+
+        void append(int index, MemoryLinkedList *head, MemoryLinkedList *last, size_t n);
         MemoryLinkedList *pop(int index);
-        MemoryLinkedList *popN(int index, int n);
+        MemoryLinkedList *popN(int index, size_t n, MemoryLinkedList *&last, size_t &cnt);
         void push(int index, MemoryLinkedList *next);
+        //  move at most n memory chunks of log2 index to dst, returns moved count
+        size_t Move(MemoryLinkedListManager *dst, int index, size_t n);
 
-        void Allocate(int core, size_t size, size_t n);
+        void Allocate(int core, size_t size, size_t n, MmapReservation* r = nullptr);
         void *Malloc(size_t size);
 
         //  index == log2(size)
@@ -55,25 +82,57 @@ class MemoryLinkedListManager {
                 lasts_[index] = dst->lasts_[index];
                 dst->lasts_[index] = tmp;
             }
+            {
+                auto tmp = lengths_[index];
+                lengths_[index] = dst->lengths_[index];
+                dst->lengths_[index] = tmp;
+            }
         }
 
         void Free(void *ptr);
 
+        size_t GetLength(int index) const
+        {
+            ASSERT(0 <= index && index < MemorySizeManager::Size, "log2\n");
+            return lengths_[index];
+        }
+        //  NOTE for other threads than the owner
+        size_t GetLengthRelaxed(int index) const
+        {
+            return relaxedLoad(lengths_[index]);
+        }
         size_t GetAllFreeLength() const
         {
-            auto cnt = 0u;
+            auto cnt = 0ul;
             for (auto i = 0; i < MemorySizeManager::Size; ++i) {
-                if (heads_[i] != nullptr) {
-                    cnt += heads_[i]->GetLength();
-                }
+                cnt += lengths_[i];
             }
             return cnt;
         }
+        //  NOTE body size of log2 index is 2^index
+        size_t GetCachedBytes() const
+        {
+            auto bytes = 0ul;
+            for (auto i = 0; i < MemorySizeManager::Size - 1; ++i) {
+                bytes += lengths_[i] << i;
+            }
+            return bytes;
+        }
         void Join(MemoryLinkedListManager *lm);
+        //  release whole pages inside bodies of chunks of 2^indexMin or more with MADV_DONTNEED,
+        //  returns released bytes
+        //  NOTE headers and links are outside the pages, so chunks stay in lists, and the pages
+        //  are faulted in as zero pages when used again
+        size_t Purge(int indexMin, size_t pageSize);
+
+        //  check signature, size, core (if core >= 0), length and last of every list
+        //  NOTE walks all chunks, so lists must not be changed meanwhile
+        bool Validate(int core = -1) const;
 
     private:
         int coreN_;
 
         MemoryLinkedList *heads_[MemorySizeManager::Size];
         MemoryLinkedList *lasts_[MemorySizeManager::Size];
+        size_t lengths_[MemorySizeManager::Size];
 };
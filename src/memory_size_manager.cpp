@@ -16,6 +16,7 @@
  */
 
 #include "memory_size_manager.hpp"
+#include "memory_linked_list.hpp"
 
 #include <unistd.h>
 #include <fcntl.h>
@@ -34,6 +35,16 @@ MemorySizeManager::MemorySizeManager()
     else {
         readSizeListFile(eval);
     }
+
+    auto colorStr = getenv("FCM_COLORING");
+    coloring_ = (colorStr != nullptr && atoi(colorStr) != 0);
+    //  NOTE only 16 and the cache line size are supported
+    auto alignStr = getenv("FCM_ALIGNMENT");
+    alignment_ = BaseAlignment;
+    if (alignStr != nullptr && (size_t)atoi(alignStr) == FCM_CACHE_LINE_SIZE && FCM_CACHE_LINE_SIZE > BaseAlignment) {
+        alignment_ = FCM_CACHE_LINE_SIZE;
+    }
+    setSlotSizes();
 }
 
 MemorySizeManager::~MemorySizeManager()
@@ -84,6 +95,41 @@ void MemorySizeManager::setDefault()
     nPerSize_[38] = 0;     //  ~256GB
 }
 
+//  colored chunks are an odd number of cache lines apart modulo ColorPeriod, so
+//  consecutive chunks of a batch start on different sets, and 4K aliasing needs many chunks
+//  in between. the step grows with size up to half the period, costing about 2% of a chunk
+void MemorySizeManager::setSlotSizes()
+{
+    const size_t line = FCM_CACHE_LINE_SIZE;
+    const size_t periodLines = ColorPeriod / line;
+    for (auto i = 0; i < Size - 1; ++i) {
+        auto size = (size_t)1 << i;
+        //  NOTE aligned bodies need aligned strides, i.e. 16 more bytes than the header of 48 bytes
+        auto slot = ALIGN(memoryLinkedListTotalSize(size), GetAlignment(i));
+        slotSizes_[i] = slot;
+        if (!IsColored(i) || periodLines < 4) {
+            continue;
+        }
+        if (size < ColorPeriod) {
+            slot = ALIGN(slot, line);
+            if ((slot / line) % 2 == 0) {
+                slot += line;
+            }
+        }
+        else {
+            auto step = (size / ColorPeriod) | 1;
+            if (step > periodLines / 2 - 1) {
+                step = periodLines / 2 - 1;
+            }
+            slot = size + step * line;
+        }
+        if (slot >= slotSizes_[i]) {
+            slotSizes_[i] = slot;
+        }
+    }
+    slotSizes_[Size - 1] = 0;
+}
+
 void MemorySizeManager::readSizeListFile(const char* filename)
 {
     const int max_num_digits = 5;
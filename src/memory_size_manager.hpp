@@ -30,15 +30,57 @@ class MemorySizeManager
         int GetMemorySize(int log2_size) const
         {
             ASSERT(0 <= log2_size && log2_size < Size, "log2_size is out of range\n");
-            return nPerSize_[log2_size];
+            return relaxedLoad(nPerSize_[log2_size]);
         }
+        //  n must be positive, and a batch of n chunks BatchBytesMax at most unless n is 1
+        bool IsValidMemorySize(int log2_size, size_t n) const
+        {
+            ASSERT(0 <= log2_size && log2_size < Size, "log2_size is out of range\n");
+            return n > 0 && (n == 1 || n <= BatchBytesMax / slotSizes_[log2_size]);
+        }
+        //  NOTE may be called while other threads refill
+        void SetMemorySize(int log2_size, int n)
+        {
+            ASSERT(0 <= log2_size && log2_size < Size, "log2_size is out of range\n");
+            __atomic_store_n(&nPerSize_[log2_size], n, __ATOMIC_RELAXED);
+        }
+
+        //  stride of memory chunks of log2_size in a batch, incl. the header
+        size_t GetSlotSize(int log2_size) const
+        {
+            ASSERT(0 <= log2_size && log2_size < Size, "log2_size is out of range\n");
+            return slotSizes_[log2_size];
+        }
+        //  NOTE with FCM_COLORING, chunks of 2^ColorMin bytes or more are spread over cache sets
+        bool IsColored(int log2_size) const
+        {
+            return coloring_ && log2_size >= ColorMin;
+        }
+
+        //  alignment of bodies of log2_size, FCM_ALIGNMENT for chunks of that size or more
+        size_t GetAlignment(int log2_size) const
+        {
+            return (((size_t)1 << log2_size) >= alignment_) ? alignment_ : BaseAlignment;
+        }
+        size_t GetMaxAlignment() const { return alignment_; }
+        bool GetColoring() const { return coloring_; }
 
         static const int Size = 64 + 1;
+        static const size_t BaseAlignment = 16;
+        static const int ColorMin = 10;
+        //  bytes of memory mapped for a batch at once
+        static const size_t BatchBytesMax = (size_t)1 << 30;
+        //  period of low address bits which cache sets and 4K aliasing depend on
+        static const size_t ColorPeriod = 4096;
 
     private:
         void setDefault();
         void readSizeListFile(const char* filename);
+        void setSlotSizes();
 
         int nPerSize_[Size];
+        bool coloring_;
+        size_t alignment_;
+        size_t slotSizes_[Size];
 };
 
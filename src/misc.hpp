@@ -22,8 +22,12 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <ctime>
 #include <pthread.h>
 #include <unistd.h> // for size_t
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 
 class mtxlock
 {
@@ -55,6 +59,40 @@ class mtxlock
 #define ALIGN_REMAIN(ptr, aligenment) ((uintptr_t)(ptr) % (aligenment))
 #define ALIGN_CHECK(ptr, aligenment) (((ptr) != 0) || ((uintptr_t)(ptr) % (aligenment)) == 0)
 
+//  alignment of per-core records, so that records of neighboring cores share no line
+//  NOTE 128 also keeps the adjacent-line prefetcher of Intel CPUs from pairing them
+#ifndef FCM_CACHE_LINE_SIZE
+#define FCM_CACHE_LINE_SIZE 64
+#endif
+
+//  functions which can be on the stack when HeapProfiler samples an allocation.
+//  the linker gathers them between __start_fcm_alloc_text and __stop_fcm_alloc_text,
+//  so their frames are skipped even if the allocator is linked into the executable
+//  NOTE inline functions are emitted in COMDAT groups, which cannot share a section
+//  with other functions, so they have a section of their own
+#define FCM_ALLOC_TEXT __attribute__((section("fcm_alloc_text")))
+#define FCM_ALLOC_INLINE_TEXT __attribute__((section("fcm_alloc_inline_text")))
+
+//  NOTE read a counter written by another thread without a lock
+template <typename T>
+inline T relaxedLoad(const T& v)
+{
+    return __atomic_load_n(&v, __ATOMIC_RELAXED);
+}
+
+//  cycle counter for latency, or nanoseconds where no counter is readable
+//  NOTE TSC is not serialized, so short intervals are approximate
+inline uint64_t readCycles()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
 inline size_t roundup_powerof2(size_t x)
 {
     x--;
@@ -100,6 +138,46 @@ inline size_t logarithm2(size_t x)
 #endif
 }
 
+//  size class table for small sizes, generated at compile time
+//  NOTE sizeClassTable[k] == logarithm2(8 * k), so sizes (8 * (k - 1), 8 * k] share entry k
+namespace SizeClass {
+    const size_t SmallMax = 1024;
+
+    constexpr size_t ceilLog2(size_t x)
+    {
+        return (x <= 1) ? 0 : 1 + ceilLog2((x + 1) / 2);
+    }
+    constexpr uint8_t smallIndex(size_t x)
+    {
+        return (x <= 8) ? 3 : (uint8_t)ceilLog2(x);
+    }
+
+    template <size_t... I> struct IndexSeq {};
+    template <size_t N, size_t... I> struct MakeIndexSeq : MakeIndexSeq<N - 1, N - 1, I...> {};
+    template <size_t... I> struct MakeIndexSeq<0, I...> { typedef IndexSeq<I...> type; };
+
+    template <typename Seq> struct Table;
+    template <size_t... I> struct Table<IndexSeq<I...>> {
+        static constexpr uint8_t value[sizeof...(I)] = { smallIndex(I * 8)... };
+    };
+    template <size_t... I> constexpr uint8_t Table<IndexSeq<I...>>::value[sizeof...(I)];
+
+    typedef Table<MakeIndexSeq<SmallMax / 8 + 1>::type> SmallTable;
+
+    static_assert(SmallTable::value[0] == 3 && SmallTable::value[1] == 3, "1-8B must be 2^3");
+    static_assert(SmallTable::value[2] == 4 && SmallTable::value[3] == 5, "9-16B must be 2^4, 17-24B must be 2^5");
+    static_assert(SmallTable::value[128] == 10 && SmallTable::value[65] == 10, "513-1024B must be 2^10");
+}
+
+//  same as logarithm2, but small sizes are looked up
+inline size_t sizeToIndex(size_t x)
+{
+    if (x <= SizeClass::SmallMax) {
+        return SizeClass::SmallTable::value[(x + 7) >> 3];
+    }
+    return logarithm2(x);
+}
+
 inline bool multCausesOverflow(size_t a, size_t b)
 {
     auto x = a * b;
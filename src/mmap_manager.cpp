@@ -18,6 +18,7 @@
 #include "mmap_manager.hpp"
 
 #include "mem_allocate.hpp"
+#include "probes.hpp"
 
 #include <cerrno>
 #include <sys/mman.h>
@@ -33,6 +34,8 @@ void MmapManager::Init(int numCores, size_t pageSize, size_t mainSize, size_t su
 {
     coreN_ = numCores;
     pageSize_ = pageSize;
+    reserveSize_ = 0;
+    extendSize_ = oneGB >> 4;
 
     threadN_ = coreN_ + 1;
     mainThreadIndex_ = threadN_ - 1;
@@ -40,15 +43,8 @@ void MmapManager::Init(int numCores, size_t pageSize, size_t mainSize, size_t su
     // the following parameter has been determined by experiment
     extendMax_ = 10000;
 
-    fcmalloc::TypeAwareMemAllocate(threadN_, &mtxs_);
-    fcmalloc::TypeAwareMemAllocate(threadN_, &firstTouchFlag_);
-    fcmalloc::TypeAwareMemAllocate(threadN_, &sizes_);
-    fcmalloc::TypeAwareMemAllocate(threadN_, &offsets_);
-    fcmalloc::TypeAwareMemAllocate(threadN_, &pools_);
-    fcmalloc::TypeAwareMemAllocate(threadN_ * extendMax_, &sizess_);
-    fcmalloc::TypeAwareMemAllocate(threadN_ * extendMax_, &poolss_);
-    fcmalloc::TypeAwareMemAllocate(threadN_, &debugSizes_);
-    fcmalloc::TypeAwareMemAllocate(threadN_, &debugOffsets_);
+    fcmalloc::TypeAwareMemAllocate(threadN_, &regions_);
+    fcmalloc::TypeAwareMemAllocate(threadN_ * extendMax_, &segments_);
 
     auto mainMmapSize = ALIGN(mainSize, pageSize_);
     auto subMmapSize  = ALIGN(subTotalSize / coreN_, pageSize_);
@@ -67,41 +63,54 @@ void MmapManager::Init(int numCores, size_t pageSize, size_t mainSize, size_t su
         auto mmapSize = (i == mainThreadIndex_) ? mainMmapSize : subMmapSize;
         auto p = (void *)mmap(nullptr, mmapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, devZero, 0);
         ASSERT((p != (void *)-1), "mmap result is -1: errno=%d\n", errno);
-        pools_[i] = p;
-        sizes_[i] = mmapSize;
-        offsets_[i] = 0;
-        debugSizes_[i] = mmapSize;
-        debugOffsets_[i] = 0;
+        auto s = &segments_[extendMax_ * i + 0];
+        s->pool = p;
+        s->size = mmapSize;
+        s->offset = 0;
+        regions_[i].current = s;
+        regions_[i].mappedSize = mmapSize;
+        regions_[i].retiredSize = 0;
 
-        sizess_[extendMax_ * i + 0] = sizes_[i];
-        poolss_[extendMax_ * i + 0] = pools_[i];
-
-        pthread_mutex_init(&mtxs_[i], nullptr);
+        pthread_mutex_init(&regions_[i].mtx, nullptr);
     }
     pthread_mutex_init(&debugMtx_, nullptr);
 
     extendOffset_ = 1;
+    lat_ = nullptr;
 }
 
+//  NOTE called with regions_[core].mtx locked
 void MmapManager::ExtendBuffer(int core, size_t size)
 {
-    ASSERT(extendOffset_ < extendMax_, "extend max fault\n");
+    //  NOTE extendOffset_ is shared by cores, which are locked separately
+    auto offset = __atomic_fetch_add(&extendOffset_, 1, __ATOMIC_RELAXED);
+    ASSERT(offset < extendMax_, "extend max fault\n");
 
     auto devZero = -1;
     auto mmapSize = ALIGN(size, pageSize_);
 
+    auto timed = (lat_ != nullptr || FCM_PROBE_ENABLED(extend));
+    uint64_t t0 = timed ? readCycles() : 0;
     auto p = (void *)mmap(nullptr, mmapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, devZero, 0);
     ASSERT(((void *)p != (void *)-1), "mmap result is -1: errno=%d\n", errno);
+    if (timed) {
+        auto cycles = readCycles() - t0;
+        if (lat_ != nullptr) {
+            lat_->GetRegionSet(core)->Get(LATENCY_EXTEND).Record(cycles);
+        }
+        FCM_PROBE(extend, core, mmapSize, cycles);
+    }
+    auto s = &segments_[extendMax_ * core + offset];
+    s->pool = p;
+    s->size = mmapSize;
+    s->offset = 0;
+
     // leak slightly, but it can be ignored
-    pools_[core] = p;
-    sizes_[core] = mmapSize;
-    offsets_[core] = 0;
-    debugSizes_[core] += mmapSize;
-    // debugOffsets_[core] = 0;
-
-    sizess_[extendMax_ * core + extendOffset_] = sizes_[core];
-    poolss_[extendMax_ * core + extendOffset_] = pools_[core];
-    extendOffset_++;
+    auto old = regions_[core].current;
+    auto used = relaxedLoad(old->offset);
+    __atomic_store_n(&regions_[core].retiredSize, regions_[core].retiredSize + ((used < old->size) ? used : old->size), __ATOMIC_RELAXED);
+    __atomic_store_n(&regions_[core].mappedSize, regions_[core].mappedSize + mmapSize, __ATOMIC_RELAXED);
+    __atomic_store_n(&regions_[core].current, s, __ATOMIC_RELEASE);
 }
 
 void MmapManager::FirstTouch(int core)
@@ -111,8 +120,8 @@ void MmapManager::FirstTouch(int core)
         core = mainThreadIndex_;
     }
 
-    auto p = pools_[core];
-    auto mmapSize = sizes_[core];
+    auto p = regions_[core].current->pool;
+    auto mmapSize = regions_[core].current->size;
     for (auto of = 0u; of < mmapSize; of += pageSize_) {
         auto tmp = (char *)((uintptr_t)p + of);
         *tmp = 0;
@@ -126,69 +135,125 @@ void *MmapManager::Malloc(int core, size_t size)
         core = mainThreadIndex_;
     }
 
-    mtxlock l(mtxs_[core]);
-
-    if (!firstTouchFlag_[core]) {
-        FirstTouch(core);
-        firstTouchFlag_[core] = true;
+    if (!__atomic_load_n(&regions_[core].firstTouched, __ATOMIC_ACQUIRE)) {
+        mtxlock l(regions_[core].mtx);
+        if (!regions_[core].firstTouched) {
+            uint64_t t0 = (lat_ != nullptr) ? readCycles() : 0;
+            FirstTouch(core);
+            if (lat_ != nullptr) {
+                lat_->GetRegionSet(core)->Get(LATENCY_FIRST_TOUCH).Record(readCycles() - t0);
+            }
+            __atomic_store_n(&regions_[core].firstTouched, true, __ATOMIC_RELEASE);
+        }
     }
 
-    size_t restSize = sizes_[core] - offsets_[core];
-    if (restSize < size) {
-        if (forceMmapFlag_) {
-            // extend pool
-            auto allocSize = ((oneGB >> 4) > size) ? oneGB >> 4 : size;
-            ExtendBuffer(core, allocSize);
-            printf("\033[31m"); // red
-            printf("extend mem : +%.3fGB ===> %.3fGB (core = %d)\n", (double)size / oneGB, (double)debugSizes_[core] / oneGB, core);
-            printf("\033[00m"); // reset
+    while (true) {
+        //  NOTE offset may exceed the size of the segment, and then the rest is left unused
+        auto s = __atomic_load_n(&regions_[core].current, __ATOMIC_ACQUIRE);
+        auto offset = __atomic_fetch_add(&s->offset, size, __ATOMIC_RELAXED);
+        if (offset + size <= s->size) {
+            return (void *)((uintptr_t)s->pool + offset);
+        }
+
+        mtxlock l(regions_[core].mtx);
+        if (relaxedLoad(regions_[core].current) != s) {
+            //  extended by another thread
+            continue;
+        }
+        if (!GetForceMmapFlag()) {
+#ifdef DEBUG
             DebugPrintWithNoMalloc();
-            // sizes_[core] maybe differ ater ExtendBuffer
-            restSize = sizes_[core] - offsets_[core];
-            if (restSize < size) {
-                DebugPrintWithNoMalloc();
-                ASSERT(false, "NO REST SIZE: core = %d, (req / rest size / max size) = (%ld/%ld/%ld)\n", core, size / oneMB, restSize / oneMB, debugSizes_[core] / oneMB);
-                return nullptr;
-            }
+#endif
+            ASSERT(false, "NO REST SIZE: core = %d, (req / max size) = (%ld/%ld)\n", core, size / oneMB, regions_[core].mappedSize / oneMB);
+            return nullptr;
         }
+        // extend pool
+        auto allocSize = (extendSize_ > size) ? extendSize_ : size;
+        ExtendBuffer(core, allocSize);
+        //  NOTE usage is published by FCM_STATS_INTVL, so a release build prints nothing
+#ifdef DEBUG
+        printf("\033[31m"); // red
+        printf("extend mem : +%.3fGB ===> %.3fGB (core = %d)\n", (double)size / oneGB, (double)regions_[core].mappedSize / oneGB, core);
+        printf("\033[00m"); // reset
+        DebugPrintWithNoMalloc();
+#endif
     }
-    auto p = (void *)((uintptr_t)pools_[core] + offsets_[core]);
-    offsets_[core] += size;
-    debugOffsets_[core] += size;
+}
 
+void *MmapManager::Malloc(int core, size_t size, MmapReservation& r)
+{
+    if (r.end - r.cur < size) {
+        if (size > reserveSize_ / 2) {
+            return Malloc(core, size);
+        }
+        auto p = Malloc(core, reserveSize_);
+        if (p == nullptr) {
+            return nullptr;
+        }
+        //  NOTE the rest of the last reservation is left unused
+        r.cur = (uintptr_t)p;
+        r.end = r.cur + reserveSize_;
+    }
+    auto p = (void *)r.cur;
+    r.cur += size;
     return p;
 }
 
+size_t MmapManager::GetUsedSize(int i) const
+{
+    auto s = __atomic_load_n(&regions_[i].current, __ATOMIC_ACQUIRE);
+    auto used = relaxedLoad(s->offset);
+    return relaxedLoad(regions_[i].retiredSize) + ((used < s->size) ? used : s->size);
+}
+
+void MmapManager::PreFork()
+{
+    for (auto i = 0; i < threadN_; ++i) {
+        pthread_mutex_lock(&regions_[i].mtx);
+    }
+    pthread_mutex_lock(&debugMtx_);
+}
+
+void MmapManager::PostForkParent()
+{
+    pthread_mutex_unlock(&debugMtx_);
+    for (auto i = threadN_ - 1; i >= 0; --i) {
+        pthread_mutex_unlock(&regions_[i].mtx);
+    }
+}
+
+void MmapManager::PostForkChild()
+{
+    for (auto i = 0; i < threadN_; ++i) {
+        pthread_mutex_init(&regions_[i].mtx, nullptr);
+    }
+    pthread_mutex_init(&debugMtx_, nullptr);
+}
+
 void MmapManager::Free() {}
 void MmapManager::Term()
 {
 #if 0
     for (int i = 0; i < threadN_; ++i) {
         for (auto j = 0; j < extendOffset_; ++j) {
-            auto size = sizess_[extendMax_ * i + j];
-            auto ptr   = poolss_[extendMax_ * i + j];
+            auto size = segments_[extendMax_ * i + j].size;
+            auto ptr   = segments_[extendMax_ * i + j].pool;
             munmap(ptr, size);
         }
     }
 #endif
-    fcmalloc::TypeAwareMemDeallocate(threadN_, debugOffsets_);
-    fcmalloc::TypeAwareMemDeallocate(threadN_, debugSizes_);
-    fcmalloc::TypeAwareMemDeallocate(threadN_ * extendMax_, poolss_);
-    fcmalloc::TypeAwareMemDeallocate(threadN_ * extendMax_, sizess_);
-    fcmalloc::TypeAwareMemDeallocate(threadN_, pools_);
-    fcmalloc::TypeAwareMemDeallocate(threadN_, offsets_);
-    fcmalloc::TypeAwareMemDeallocate(threadN_, sizes_);
-    fcmalloc::TypeAwareMemDeallocate(threadN_, firstTouchFlag_);
-    fcmalloc::TypeAwareMemDeallocate(threadN_, mtxs_);
+    fcmalloc::TypeAwareMemDeallocate(threadN_ * extendMax_, segments_);
+    fcmalloc::TypeAwareMemDeallocate(threadN_, regions_);
 }
 
+#ifdef DEBUG
 void MmapManager::DebugPrintWithNoMalloc() const
 {
     mtxlock l(debugMtx_);
     //  NOTE unit is MB
     for (auto i = 0; i < threadN_; ++i) {
-        auto sizeMax  = (double)debugSizes_[i] / oneGB;
-        auto sizeVal  = (double)debugOffsets_[i] / oneGB;
+        auto sizeMax  = (double)GetMappedSize(i) / oneGB;
+        auto sizeVal  = (double)GetUsedSize(i) / oneGB;
         auto ratio    = sizeVal / sizeMax;
         const auto charN = 48;
         auto tmp      = ratio;
@@ -225,7 +290,7 @@ void MmapManager::DebugPrintWithNoMalloc() const
         printf("%2d:[", i);
         for (auto i = 0; i < charN; ++i) {
             auto tmp = (double)(i + 1) / charN;
-            if (tmp <= ratio || (i == charN && debugSizes_[i] == debugOffsets_[i])) {
+            if (tmp <= ratio || (i == charN && regions_[i].mappedSize == regions_[i].retiredSize)) {
                 printf("=");
             }
             else {
@@ -237,4 +302,4 @@ void MmapManager::DebugPrintWithNoMalloc() const
         printf("\033[00m");
     }
 }
-
+#endif
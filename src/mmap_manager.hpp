@@ -18,44 +18,90 @@
 #pragma once
 
 #include "common.hpp"
+#include "latency_recorder.hpp"
+
+//  memory reserved from a region at once, and carved by its owner without lock
+struct MmapReservation {
+    uintptr_t cur;
+    uintptr_t end;
+};
 
 class MmapManager {
     public:
         void Init(int numCores, size_t pageSize, size_t mainSize, size_t subTotalSize);
+        //  NOTE lock free unless the region of core is extended
         void *Malloc(int core, size_t size);
+        //  carve size from r, which is refilled by the reserve size from the region of core
+        //  NOTE r is owned by the calling thread, and size larger than half of
+        //  the reserve size is allocated from the region directly
+        void *Malloc(int core, size_t size, MmapReservation& r);
         void Free();
         void Term();
 
-        void SetForceMmapFlag(bool forceMmapFlag) { forceMmapFlag_ = forceMmapFlag; }
+        void SetForceMmapFlag(bool forceMmapFlag) { __atomic_store_n(&forceMmapFlag_, forceMmapFlag, __ATOMIC_RELAXED); }
+        bool GetForceMmapFlag() const { return relaxedLoad(forceMmapFlag_); }
 
         size_t GetPageSize() const { return pageSize_; }
+        //  0 means that every Malloc with reservation goes to the region
+        void SetReserveSize(size_t size) { reserveSize_ = ALIGN(size, pageSize_); }
+        size_t GetReserveSize() const { return reserveSize_; }
+        //  minimum size of memory mmap-ed when a region is extended
+        void SetExtendSize(size_t size) { extendSize_ = ALIGN(size, pageSize_); }
+        void SetLatency(LatencyRecorder& lat) { lat_ = lat.IsEnabled() ? &lat : nullptr; }
+
+        //  NOTE region index is core, and the last one is for main thread
+        int GetRegionN() const { return threadN_; }
+        size_t GetMappedSize(int i) const { return relaxedLoad(regions_[i].mappedSize); }
+        size_t GetUsedSize(int i) const;
+
+        //  NOTE called by pthread_atfork handlers in the order of mainPreFork
+        void PreFork();
+        void PostForkParent();
+        void PostForkChild();
 
     private:
+        //  a mmap-ed buffer, offset is advanced by fetch-add
+        struct alignas(FCM_CACHE_LINE_SIZE) Segment {
+            void* pool;
+            size_t size;
+            size_t offset;
+        };
+        //  per region, fields read by every Malloc come first
+        //  NOTE mtx is locked only to touch or extend the region
+        struct alignas(FCM_CACHE_LINE_SIZE) Region {
+            //  segment which is carved now
+            Segment* current;
+            bool firstTouched;
+            pthread_mutex_t mtx;
+            size_t mappedSize;
+            //  used size of the segments before the current one
+            size_t retiredSize;
+        };
+
         void ExtendBuffer(int core, size_t size);
         void FirstTouch(int core);
 
+#ifdef DEBUG
         void DebugPrintWithNoMalloc() const;
+#endif
 
         int coreN_;
         int threadN_;
         int mainThreadIndex_;
 
         size_t pageSize_;
+        size_t reserveSize_;
+        size_t extendSize_;
 
-        pthread_mutex_t *mtxs_;
-        bool* firstTouchFlag_;
-        size_t* sizes_;
-        size_t* offsets_;
-        void** pools_;
+        Region* regions_;
 
         int extendMax_;
         int extendOffset_;
-        size_t* sizess_;
-        void** poolss_;
+        Segment* segments_;
 
         bool forceMmapFlag_;
+        //  nullptr unless FCM_LATENCY_OUTPUT is set
+        LatencyRecorder* lat_;
 
         mutable pthread_mutex_t debugMtx_;
-        size_t* debugSizes_;
-        size_t* debugOffsets_;
 };
@@ -0,0 +1,26 @@
+/*
+ * Copyright 2017 Yamana Laboratory, Waseda University
+ * Supported by JST CREST Grant Number JPMJCR1503, Japan.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "probes.hpp"
+
+#ifdef FCM_HAVE_PROBES
+//  NOTE a tracer increments the semaphore of a probe while attached
+#define FCM_PROBE_DEFINE(name) \
+    volatile unsigned short FCM_PROBE_SEMAPHORE(name) __attribute__((section(".probes"))) = 0;
+FCM_PROBE_LIST(FCM_PROBE_DEFINE)
+#undef FCM_PROBE_DEFINE
+#endif
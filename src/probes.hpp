@@ -0,0 +1,64 @@
+/*
+ * Copyright 2017 Yamana Laboratory, Waseda University
+ * Supported by JST CREST Grant Number JPMJCR1503, Japan.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+//  USDT probes of provider `fcmalloc` on slow paths, which bpftrace and SystemTap attach to.
+//  see tools/bpftrace/
+//  NOTE a probe is a nop unless traced, and FCM_PROBE_ENABLED(name) tests its semaphore,
+//  so arguments measured only for tracing, e.g. latency, cost nothing otherwise.
+//  only the header sys/sdt.h is needed, and probes are left out if it is not found
+//  or FCM_NO_PROBES is defined
+
+#include "misc.hpp"
+
+#if !defined(FCM_NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define FCM_HAVE_PROBES 1
+#endif
+#endif
+
+//  X(name) for each probe
+#define FCM_PROBE_LIST(X) \
+    X(swap)     /* core, log2 size, #chunk after swap (0 = miss) */ \
+    X(pool_get) /* core, log2 size, #chunk taken from the common memory pool (0 = miss) */ \
+    X(pool_put) /* core, #chunk returned to the common memory pool */ \
+    X(refill)   /* core, log2 size, #chunk, carved (1) or pooled (0), cycles */ \
+    X(batch)    /* core, log2 size, bytes newly mapped for carving */ \
+    X(extend)   /* core, bytes, cycles of mmap */ \
+    X(flush)    /* core, #chunk of other cores returned to the pool, cycles */
+
+#ifdef FCM_HAVE_PROBES
+
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+#define FCM_PROBE_SEMAPHORE(name) fcmalloc_##name##_semaphore
+#define FCM_PROBE_DECLARE(name) \
+    extern volatile unsigned short FCM_PROBE_SEMAPHORE(name) __attribute__((visibility("hidden")));
+FCM_PROBE_LIST(FCM_PROBE_DECLARE)
+#undef FCM_PROBE_DECLARE
+
+#define FCM_PROBE_ENABLED(name) __builtin_expect(FCM_PROBE_SEMAPHORE(name) != 0, 0)
+#define FCM_PROBE(name, ...) STAP_PROBEV(fcmalloc, name, __VA_ARGS__)
+
+#else
+
+#define FCM_PROBE_ENABLED(name) false
+#define FCM_PROBE(name, ...) do {} while (0)
+
+#endif
@@ -0,0 +1,75 @@
+/*
+ * Copyright 2017 Yamana Laboratory, Waseda University
+ * Supported by JST CREST Grant Number JPMJCR1503, Japan.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "common.hpp"
+#include "mem_allocate.hpp"
+
+//  single producer single consumer ring of T, capacity is a power of 2
+//  NOTE storage is mmap-ed, and pages are touched when used
+template <typename T>
+class RingBuffer {
+    public:
+        void Init(size_t capacity)
+        {
+            capacity = roundup_powerof2(capacity);
+            mask_ = capacity - 1;
+            head_ = 0;
+            tail_ = 0;
+            fcmalloc::TypeAwareMemAllocate(capacity, &buf_);
+        }
+
+        //  called by the producer, returns false if full
+        bool Push(const T& v)
+        {
+            auto tail = tail_;
+            if (tail - __atomic_load_n(&head_, __ATOMIC_ACQUIRE) > mask_) {
+                return false;
+            }
+            buf_[tail & mask_] = v;
+            __atomic_store_n(&tail_, tail + 1, __ATOMIC_RELEASE);
+            return true;
+        }
+
+        //  called by the consumer, returns #element copied to out
+        size_t Pop(T* out, size_t n)
+        {
+            auto head = head_;
+            auto size = __atomic_load_n(&tail_, __ATOMIC_ACQUIRE) - head;
+            if (n > size) {
+                n = size;
+            }
+            for (auto i = 0ul; i < n; ++i) {
+                out[i] = buf_[(head + i) & mask_];
+            }
+            __atomic_store_n(&head_, head + n, __ATOMIC_RELEASE);
+            return n;
+        }
+
+        size_t GetSize() const
+        {
+            return __atomic_load_n(&tail_, __ATOMIC_ACQUIRE) - __atomic_load_n(&head_, __ATOMIC_ACQUIRE);
+        }
+
+    private:
+        T* buf_;
+        size_t mask_;
+        //  NOTE head_ is written by the consumer, tail_ by the producer
+        alignas(FCM_CACHE_LINE_SIZE) size_t head_;
+        alignas(FCM_CACHE_LINE_SIZE) size_t tail_;
+};
@@ -0,0 +1,79 @@
+/*
+ * Copyright 2017 Yamana Laboratory, Waseda University
+ * Supported by JST CREST Grant Number JPMJCR1503, Japan.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "fcmalloc.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+//  live statistics published to `/dev/shm/fcmalloc.<pid>`, which is read by tools/fcmtop
+//  NOTE a background thread of the allocator is the only writer, and readers retry
+//  while seq is odd or changes during the copy (seqlock)
+#define FCM_STATS_PAGE_MAGIC   0x53544154534d4346ull  // "FCMSTATS"
+#define FCM_STATS_PAGE_VERSION 1
+//  #region published, regions beyond are left out
+#define FCM_STATS_PAGE_REGIONS 256
+
+struct StatsPageRegion {
+    uint64_t mapped;  // bytes mmap-ed for the region
+    uint64_t used;    // bytes carved from the region
+    uint64_t cached;  // free bytes cached by threads of the core
+    uint64_t pooled;  // free bytes in the common memory pool of the core
+};
+
+struct StatsPage {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t size;      // sizeof(StatsPage)
+    uint64_t seq;
+    uint64_t time;      // ns of CLOCK_MONOTONIC at the last update
+    uint32_t pid;
+    uint32_t regionN;   // #core + 1, and the last region is for main thread
+    struct fcm_stats stats;
+    StatsPageRegion regions[FCM_STATS_PAGE_REGIONS];
+};
+
+//  copy the fields after seq of src to page
+inline void statsPageWrite(StatsPage* page, const StatsPage& src)
+{
+    const size_t offset = offsetof(StatsPage, time);
+    auto seq = page->seq;
+    __atomic_store_n(&page->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy((char *)page + offset, (const char *)&src + offset, sizeof(StatsPage) - offset);
+    __atomic_store_n(&page->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+//  returns false if the writer keeps updating
+inline bool statsPageRead(const StatsPage* page, StatsPage& dst)
+{
+    for (auto i = 0; i < 1000; ++i) {
+        auto seq = __atomic_load_n(&page->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            continue;
+        }
+        memcpy(&dst, page, sizeof(StatsPage));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&page->seq, __ATOMIC_RELAXED) == seq) {
+            return true;
+        }
+    }
+    return false;
+}
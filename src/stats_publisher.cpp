@@ -0,0 +1,125 @@
+/*
+ * Copyright 2017 Yamana Laboratory, Waseda University
+ * Supported by JST CREST Grant Number JPMJCR1503, Japan.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "stats_publisher.hpp"
+#include "common_memory_pool.hpp"
+#include "global_memory_manager.hpp"
+#include "mallctl.hpp"
+#include "mmap_manager.hpp"
+#include "stats_page.hpp"
+
+#include <cstdio>
+#include <ctime>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+void StatsPublisher::Init(int numCores, Mallctl& ctl, GlobalMemoryManager& g, CommonMemoryPool& cmp, MmapManager& mm)
+{
+    coreN_ = numCores;
+    ctl_ = &ctl;
+    g_ = &g;
+    cmp_ = &cmp;
+    mm_ = &mm;
+    pid_ = 0;
+    path_[0] = '\0';
+    page_ = nullptr;
+
+    auto intvlStr = getenv("FCM_STATS_INTVL");
+    intvl_ = (intvlStr == nullptr) ? 0 : atol(intvlStr);
+}
+
+void StatsPublisher::publish()
+{
+    //  NOTE about 12KB on the stack of the writer
+    StatsPage src;
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    src.time = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    ctl_->CollectStats(src.stats);
+    auto n = mm_->GetRegionN();
+    if (n > FCM_STATS_PAGE_REGIONS) {
+        n = FCM_STATS_PAGE_REGIONS;
+    }
+    for (auto i = 0; i < n; ++i) {
+        auto& r = src.regions[i];
+        r.mapped = mm_->GetMappedSize(i);
+        r.used = mm_->GetUsedSize(i);
+        r.cached = (i < coreN_) ? g_->GetCachedBytes(i) : 0;
+        r.pooled = (i < coreN_) ? cmp_->GetPooledBytes(i) : 0;
+    }
+    src.pid = pid_;
+    src.regionN = n;
+    statsPageWrite(page_, src);
+}
+
+void* StatsPublisher::writer(void* arg)
+{
+    auto p = (StatsPublisher *)arg;
+    timespec ts;
+    ts.tv_sec = p->intvl_ / 1000;
+    ts.tv_nsec = (p->intvl_ % 1000) * 1000000;
+    while (true) {
+        p->publish();
+        nanosleep(&ts, nullptr);
+    }
+    return nullptr;
+}
+
+void StatsPublisher::Start()
+{
+    if (intvl_ <= 0) {
+        return;
+    }
+    pid_ = getpid();
+    snprintf(path_, sizeof(path_), "/dev/shm/fcmalloc.%d", (int)pid_);
+    auto fd = open(path_, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        myprintf(stderr_fd, "fcmalloc: cannot open %s\n", path_);
+        return;
+    }
+    if (ftruncate(fd, sizeof(StatsPage)) != 0) {
+        close(fd);
+        unlink(path_);
+        return;
+    }
+    auto p = mmap(nullptr, sizeof(StatsPage), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        unlink(path_);
+        return;
+    }
+    page_ = (StatsPage *)p;
+    //  NOTE the file is zero filled, and magic is written last, so a reader which
+    //  finds magic sees a whole page
+    page_->version = FCM_STATS_PAGE_VERSION;
+    page_->size = sizeof(StatsPage);
+    publish();
+    __atomic_store_n(&page_->magic, FCM_STATS_PAGE_MAGIC, __ATOMIC_RELEASE);
+
+    pthread_t th;
+    if (pthread_create(&th, nullptr, writer, this) == 0) {
+        pthread_detach(th);
+    }
+}
+
+void StatsPublisher::Term()
+{
+    if (page_ == nullptr || pid_ != getpid()) {
+        return;
+    }
+    unlink(path_);
+}
@@ -0,0 +1,57 @@
+/*
+ * Copyright 2017 Yamana Laboratory, Waseda University
+ * Supported by JST CREST Grant Number JPMJCR1503, Japan.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "common.hpp"
+
+struct StatsPage;
+
+class CommonMemoryPool;
+class GlobalMemoryManager;
+class Mallctl;
+class MmapManager;
+
+//  publishes statistics to `/dev/shm/fcmalloc.<pid>` every FCM_STATS_INTVL ms
+//  NOTE counters are read by a background thread, so malloc and free neither lock nor
+//  call the system for it
+class StatsPublisher {
+    public:
+        void Init(int numCores, Mallctl& ctl, GlobalMemoryManager& g, CommonMemoryPool& cmp, MmapManager& mm);
+        bool IsEnabled() const { return intvl_ > 0; }
+
+        //  create the page and start the writer thread
+        void Start();
+        //  remove the page
+        //  NOTE the child of fork neither publishes nor removes the page of the parent
+        void Term();
+
+    private:
+        static void* writer(void* arg);
+        void publish();
+
+        int coreN_;
+        Mallctl* ctl_;
+        GlobalMemoryManager* g_;
+        CommonMemoryPool* cmp_;
+        MmapManager* mm_;
+
+        long intvl_;
+        pid_t pid_;
+        char path_[64];
+        StatsPage* page_;
+};
@@ -0,0 +1,49 @@
+/*
+ * Copyright 2017 Yamana Laboratory, Waseda University
+ * Supported by JST CREST Grant Number JPMJCR1503, Japan.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+//  binary trace written to FCM_TRACE_OUTPUT, which is read by tools/fcm_replay
+//  a file is a TraceHeader followed by TraceRecords.
+//  NOTE records of different threads are not sorted, so sort them by time
+#define FCM_TRACE_MAGIC   0x45434152544d4346ull  // "FCMTRACE"
+#define FCM_TRACE_VERSION 1
+
+enum TraceOp : uint8_t {
+    TRACE_MALLOC = 1,
+    TRACE_FREE   = 2,
+};
+
+struct TraceHeader {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t recordSize;
+};
+
+struct TraceRecord {
+    uint64_t time;    // ns of CLOCK_MONOTONIC
+    uint64_t ptr;     // address of the body, which identifies the chunk while it is alive
+    uint64_t size;    // requested size for malloc, chunk size for free
+    uint32_t thread;  // tid
+    uint16_t core;    // core of the local memory manager
+    uint8_t op;       // TraceOp
+    uint8_t reserved;
+};
+
+static_assert(sizeof(TraceRecord) == 32, "TraceRecord must be 32B");
@@ -0,0 +1,157 @@
+/*
+ * Copyright 2017 Yamana Laboratory, Waseda University
+ * Supported by JST CREST Grant Number JPMJCR1503, Japan.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "trace_recorder.hpp"
+
+#include <ctime>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/syscall.h>
+
+namespace {
+    const int DRAIN_MAX = 1024;
+
+    uint32_t gettid_()
+    {
+        static thread_local uint32_t tid = 0;
+        if (tid == 0) {
+            tid = syscall(SYS_gettid);
+        }
+        return tid;
+    }
+}
+
+void TraceRecorder::Init(int numRings)
+{
+    mtx_ = PTHREAD_MUTEX_INITIALIZER;
+    ringN_ = numRings;
+    rings_ = nullptr;
+    fd_ = -1;
+    running_ = false;
+    closed_ = false;
+    dropped_ = 0;
+
+    auto output = getenv("FCM_TRACE_OUTPUT");
+    if (output == nullptr) {
+        return;
+    }
+    fd_ = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd_ == -1) {
+        myprintf(stderr_fd, "fcmalloc: cannot open FCM_TRACE_OUTPUT %s\n", output);
+        return;
+    }
+    TraceHeader header = { FCM_TRACE_MAGIC, FCM_TRACE_VERSION, sizeof(TraceRecord) };
+    write(fd_, &header, sizeof(header));
+
+    //  NOTE #record per ring
+    auto bufStr = getenv("FCM_TRACE_BUFFER_SIZE");
+    size_t capacity = (bufStr == nullptr) ? 65536 : atoll(bufStr);
+    fcmalloc::TypeAwareMemAllocate(ringN_, &rings_);
+    for (auto i = 0; i < ringN_; ++i) {
+        rings_[i].Init(capacity);
+    }
+}
+
+void TraceRecorder::Record(Ring* ring, TraceOp op, void* ptr, size_t size, int core)
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    TraceRecord r;
+    r.time = ts.tv_sec * 1000000000ull + ts.tv_nsec;
+    r.ptr = (uintptr_t)ptr;
+    r.size = size;
+    r.thread = gettid_();
+    r.core = core;
+    r.op = op;
+    r.reserved = 0;
+    while (!ring->Push(r)) {
+        if (!relaxedLoad(running_)) {
+            __atomic_add_fetch(&dropped_, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        sched_yield();
+    }
+}
+
+size_t TraceRecorder::drain()
+{
+    TraceRecord buf[DRAIN_MAX];
+    size_t total = 0;
+    mtxlock l(mtx_);
+    for (auto i = 0; i < ringN_; ++i) {
+        size_t n;
+        while ((n = rings_[i].Pop(buf, DRAIN_MAX)) > 0) {
+            write(fd_, buf, n * sizeof(TraceRecord));
+            total += n;
+        }
+    }
+    return total;
+}
+
+void* TraceRecorder::writer(void* arg)
+{
+    auto trace = (TraceRecorder *)arg;
+    const timespec intvl = { 0, 1000000 };
+    while (!relaxedLoad(trace->closed_)) {
+        if (trace->drain() == 0) {
+            nanosleep(&intvl, nullptr);
+        }
+    }
+    return nullptr;
+}
+
+void TraceRecorder::Start()
+{
+    if (rings_ == nullptr) {
+        return;
+    }
+    __atomic_store_n(&running_, true, __ATOMIC_RELAXED);
+    pthread_t th;
+    if (pthread_create(&th, nullptr, writer, this) == 0) {
+        pthread_detach(th);
+    }
+    else {
+        __atomic_store_n(&running_, false, __ATOMIC_RELAXED);
+    }
+}
+
+void TraceRecorder::PostForkChild()
+{
+    mtx_ = PTHREAD_MUTEX_INITIALIZER;
+    if (rings_ == nullptr) {
+        return;
+    }
+    close(fd_);
+    fd_ = -1;
+    rings_ = nullptr;
+    running_ = false;
+    closed_ = true;
+}
+
+void TraceRecorder::Term()
+{
+    if (rings_ == nullptr) {
+        return;
+    }
+    __atomic_store_n(&running_, false, __ATOMIC_RELAXED);
+    __atomic_store_n(&closed_, true, __ATOMIC_RELAXED);
+    drain();
+    auto dropped = GetDropped();
+    if (dropped > 0) {
+        myprintf(stderr_fd, "fcmalloc: %lu trace records are dropped\n", dropped);
+    }
+}
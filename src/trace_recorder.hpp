@@ -0,0 +1,63 @@
+/*
+ * Copyright 2017 Yamana Laboratory, Waseda University
+ * Supported by JST CREST Grant Number JPMJCR1503, Japan.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "common.hpp"
+#include "ring_buffer.hpp"
+#include "trace_format.hpp"
+
+//  records every malloc/free to FCM_TRACE_OUTPUT
+//  each local memory manager pushes records to its own ring, and a background
+//  thread writes them, so recording never calls malloc or write
+class TraceRecorder {
+    public:
+        typedef RingBuffer<TraceRecord> Ring;
+
+        void Init(int numRings);
+        bool IsEnabled() const { return rings_ != nullptr; }
+        Ring* GetRing(int i) { return (rings_ == nullptr) ? nullptr : &rings_[i]; }
+
+        //  NOTE waits for the writer if the ring is full, or drops the record before Start()
+        void Record(Ring* ring, TraceOp op, void* ptr, size_t size, int core);
+
+        //  start the writer thread
+        void Start();
+        //  write all records, and drop records from now on
+        void Term();
+
+        size_t GetDropped() const { return relaxedLoad(dropped_); }
+
+        //  NOTE called by pthread_atfork handlers in the order of mainPreFork
+        void PreFork() { pthread_mutex_lock(&mtx_); }
+        void PostForkParent() { pthread_mutex_unlock(&mtx_); }
+        //  NOTE the trace file belongs to the parent, so the child records nothing
+        void PostForkChild();
+
+    private:
+        static void* writer(void* arg);
+        size_t drain();
+
+        pthread_mutex_t mtx_;
+
+        int ringN_;
+        Ring* rings_;
+        int fd_;
+        bool running_;
+        bool closed_;
+        size_t dropped_;
+};
@@ -0,0 +1,159 @@
+/*
+ * Copyright 2017 Yamana Laboratory, Waseda University
+ * Supported by JST CREST Grant Number JPMJCR1503, Japan.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//  checks that posix_memalign, aligned_alloc, memalign, valloc and pvalloc return blocks
+//  of the alignment for every power of 2 up to MAX_ALIGNMENT, which do not overlap,
+//  and that realloc and free take them
+//  NOTE linked with libfcmalloc.a, and run with and without FCM_ALIGNMENT
+//  exits with 1 if a check fails
+
+#include "fcmalloc.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <malloc.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+    int failures = 0;
+
+#define CHECK(cond, ...)                                  \
+    do {                                                  \
+        if (!(cond)) {                                    \
+            fprintf(stderr, "%s:%d: ", __FILE__, __LINE__); \
+            fprintf(stderr, __VA_ARGS__);                 \
+            fprintf(stderr, "\n");                        \
+            ++failures;                                   \
+        }                                                 \
+    } while (0)
+
+    const size_t sizes[] = { 0, 1, 8, 17, 32, 33, 63, 64, 65, 100, 1000, 4097, 100000 };
+    //  NOTE larger than a page, and than any body alignment
+    const size_t MAX_ALIGNMENT = 65536;
+
+    struct Block {
+        void *ptr;
+        size_t size;
+    };
+
+    void fill(const Block& b)
+    {
+        memset(b.ptr, (int)((uintptr_t)b.ptr >> 4), b.size);
+    }
+
+    bool verify(const Block& b)
+    {
+        auto c = (unsigned char)((uintptr_t)b.ptr >> 4);
+        auto bytes = (unsigned char *)b.ptr;
+        for (size_t i = 0; i < b.size; ++i) {
+            if (bytes[i] != c) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void add(std::vector<Block>& blocks, const char* name, void *p, size_t alignment, size_t size)
+    {
+        //  NOTE malloc(0) of FCMalloc returns nullptr
+        CHECK(p != nullptr || size == 0, "%s(%zu, %zu) returns nullptr", name, alignment, size);
+        CHECK(((uintptr_t)p % alignment) == 0, "%s(%zu, %zu) returns %p", name, alignment, size, p);
+        if (p != nullptr) {
+            blocks.push_back(Block{ p, size });
+            fill(blocks.back());
+        }
+    }
+
+    //  NOTE blocks are kept until the end, so each one comes from a different chunk
+    void checkAlignment(size_t alignment, std::vector<Block>& blocks)
+    {
+        for (auto size : sizes) {
+            void *p = nullptr;
+            auto err = posix_memalign(&p, alignment, size);
+            CHECK(err == 0, "posix_memalign(%zu, %zu) returns %d", alignment, size, err);
+            add(blocks, "posix_memalign", p, alignment, size);
+
+            //  NOTE aligned_alloc of C11 takes a multiple of the alignment
+            auto asize = (size + alignment - 1) / alignment * alignment;
+            add(blocks, "aligned_alloc", aligned_alloc(alignment, (asize == 0) ? alignment : asize), alignment, asize);
+            add(blocks, "memalign", memalign(alignment, size), alignment, size);
+        }
+    }
+
+    void checkAll()
+    {
+        std::vector<Block> blocks;
+        for (auto a = sizeof(void *); a <= MAX_ALIGNMENT; a *= 2) {
+            checkAlignment(a, blocks);
+        }
+        auto pageSize = (size_t)sysconf(_SC_PAGESIZE);
+        for (auto size : sizes) {
+            add(blocks, "valloc", valloc(size), pageSize, size);
+            add(blocks, "pvalloc", pvalloc(size), pageSize, size);
+        }
+        void *p = nullptr;
+        CHECK(posix_memalign(&p, 24, 64) == EINVAL, "posix_memalign of 24");
+
+        for (auto& b : blocks) {
+            CHECK(verify(b), "%p of %zu bytes is overwritten", b.ptr, b.size);
+        }
+        //  realloc keeps the contents of every other block, and frees the rest
+        for (size_t i = 0; i < blocks.size(); ++i) {
+            auto& b = blocks[i];
+            if (i % 2 == 0) {
+                free(b.ptr);
+                continue;
+            }
+            //  NOTE the pattern follows the old address
+            auto c = (unsigned char)((uintptr_t)b.ptr >> 4);
+            auto q = (unsigned char *)realloc(b.ptr, b.size * 2 + 1);
+            CHECK(q != nullptr, "realloc of %p", b.ptr);
+            if (q == nullptr) {
+                continue;
+            }
+            for (size_t j = 0; j < b.size; ++j) {
+                if (q[j] != c) {
+                    CHECK(false, "realloc of %p to %p loses contents", b.ptr, q);
+                    break;
+                }
+            }
+            free(q);
+        }
+    }
+}
+
+int main()
+{
+    size_t maxAlignment = 0;
+    size_t len = sizeof(maxAlignment);
+    if (fcm_mallctl("opt.alignment", &maxAlignment, &len, nullptr, 0) != 0) {
+        fprintf(stderr, "opt.alignment is not found\n");
+        return 1;
+    }
+    printf("aligned_alloc: bodies aligned to %zu\n", maxAlignment);
+
+    checkAll();
+    std::thread th(checkAll);
+    th.join();
+    printf("aligned_alloc: %s\n", (failures == 0) ? "ok" : "failed");
+    return (failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,99 @@
+/*
+ * Copyright 2017 Yamana Laboratory, Waseda University
+ * Supported by JST CREST Grant Number JPMJCR1503, Japan.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//  checks that fcm_mallctl and FCM_CONF_FILE reject values out of range
+//  NOTE linked with libfcmalloc.a, and run with mallctl.conf as FCM_CONF_FILE
+//  exits with 1 if a check fails
+
+#include "fcmalloc.h"
+
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+namespace {
+    int failures = 0;
+
+#define CHECK(cond, ...)                                  \
+    do {                                                  \
+        if (!(cond)) {                                    \
+            fprintf(stderr, "%s:%d: ", __FILE__, __LINE__); \
+            fprintf(stderr, __VA_ARGS__);                 \
+            fprintf(stderr, "\n");                        \
+            ++failures;                                   \
+        }                                                 \
+    } while (0)
+
+    int getNper(const char* name)
+    {
+        int n = -1;
+        size_t len = sizeof(n);
+        auto err = fcm_mallctl(name, &n, &len, nullptr, 0);
+        CHECK(err == 0, "read of %s returns %d", name, err);
+        return n;
+    }
+
+    int setNper(const char* name, int n)
+    {
+        return fcm_mallctl(name, nullptr, nullptr, &n, sizeof(n));
+    }
+
+    void checkNper()
+    {
+        auto n = getNper("size.10.nper");
+        const int invalid[] = { 0, -1, INT_MIN, INT_MAX };
+        for (auto v : invalid) {
+            auto err = setNper("size.10.nper", v);
+            CHECK(err == EINVAL, "size.10.nper = %d returns %d", v, err);
+            CHECK(getNper("size.10.nper") == n, "size.10.nper is changed by %d", v);
+        }
+        //  NOTE one chunk of any size is allowed, and only 1 of 2^40B
+        CHECK(setNper("size.40.nper", 1) == 0, "size.40.nper = 1");
+        CHECK(setNper("size.40.nper", 2) == EINVAL, "size.40.nper = 2");
+        CHECK(setNper("size.64.nper", 1) == ENOENT, "size.64.nper");
+
+        CHECK(setNper("size.10.nper", 2048) == 0, "size.10.nper = 2048");
+        CHECK(getNper("size.10.nper") == 2048, "size.10.nper is not set");
+        std::vector<void *> ptrs;
+        for (auto i = 0; i < 20000; ++i) {
+            auto p = malloc(1000);
+            CHECK(p != nullptr, "malloc(1000) fails at %d", i);
+            if (p == nullptr) {
+                break;
+            }
+            ptrs.push_back(p);
+        }
+        for (auto p : ptrs) {
+            free(p);
+        }
+    }
+}
+
+int main()
+{
+    //  NOTE mallctl.conf sets 0 to size.10.nper, which is ignored, and 300 to size.11.nper
+    if (getenv("FCM_CONF_FILE") != nullptr) {
+        free(malloc(1));
+        CHECK(getNper("size.10.nper") == 1024, "size.10.nper = 0 of FCM_CONF_FILE is applied");
+        CHECK(getNper("size.11.nper") == 300, "size.11.nper = 300 of FCM_CONF_FILE is not applied");
+    }
+    checkNper();
+    printf("mallctl: %s\n", (failures == 0) ? "ok" : "failed");
+    return (failures == 0) ? 0 : 1;
+}
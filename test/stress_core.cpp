@@ -0,0 +1,443 @@
+/*
+ * Copyright 2017 Yamana Laboratory, Waseda University
+ * Supported by JST CREST Grant Number JPMJCR1503, Japan.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//  deterministic checks of the allocator classes, linked directly instead of LD_PRELOAD
+//  model: random operations on MemoryLinkedListManager compared with a model
+//  threads: threads which come and go, and free chunks of other threads and cores
+//  rebinding: the same with threads started on a fake core, which move to their CPU
+//  budget: shares of FCM_THREAD_CACHE_MAX while threads come and go
+//  exits with 1 if a check fails
+//  usage: stress_core <model|threads|rebinding|budget> [seed] [#ops] [#threads] [#generations] [#cores]
+
+#include "src/common_memory_pool.hpp"
+#include "src/global_memory_manager.hpp"
+#include "src/heap_profiler.hpp"
+#include "src/local_memory_manager.hpp"
+#include "src/memory_linked_list_manager.hpp"
+#include "src/memory_size_manager.hpp"
+#include "src/mmap_manager.hpp"
+#include "fcmalloc.h"
+
+#include "bench/bench_util.hpp"
+
+#include <mutex>
+#include <sched.h>
+#include <string>
+#include <thread>
+#include <unordered_set>
+
+//  NOTE defined in fcmalloc.cpp, which is not linked
+MmapManager mm;
+thread_local bool mainThreadFlag = false;
+
+namespace {
+    int failures = 0;
+
+#define CHECK(cond, ...)                                  \
+    do {                                                  \
+        if (!(cond)) {                                    \
+            fprintf(stderr, "%s:%d: ", __FILE__, __LINE__); \
+            fprintf(stderr, __VA_ARGS__);                 \
+            fprintf(stderr, "\n");                        \
+            ++failures;                                   \
+        }                                                 \
+    } while (0)
+
+    //  model of a list, the back is the head
+    typedef std::vector<MemoryLinkedList *> Model;
+
+    const int MANAGER_N = 4;
+    const int indexes[] = { 4, 6, 10 };
+
+    //  pop all chunks to compare the order with the model, and push them back
+    void compareOrder(MemoryLinkedListManager& l, int index, const Model& model)
+    {
+        std::vector<MemoryLinkedList *> popped;
+        while (auto m = l.pop(index)) {
+            popped.push_back(m);
+        }
+        CHECK(popped.size() == model.size(), "2^%d: %zu chunks, model has %zu", index, popped.size(), model.size());
+        for (size_t i = 0; i < popped.size() && i < model.size(); ++i) {
+            CHECK(popped[i] == model[model.size() - 1 - i], "2^%d: order differs at %zu", index, i);
+        }
+        for (auto it = popped.rbegin(); it != popped.rend(); ++it) {
+            l.push(index, *it);
+        }
+    }
+
+    void testModel(uint64_t seed, int nops)
+    {
+        bench::Rand rnd(seed);
+        MemoryLinkedListManager lists[MANAGER_N];
+        Model models[MANAGER_N][MemorySizeManager::Size];
+        std::vector<MemoryLinkedList *> stash[MemorySizeManager::Size];
+        for (auto& l : lists) {
+            l.Init(1);
+        }
+        for (auto index : indexes) {
+            auto r = allocateMemoryLinkedList(1, 0, (size_t)1 << index, 256);
+            for (auto m = r.head; m != nullptr; m = m->GetNext()) {
+                stash[index].push_back(m);
+            }
+            for (auto m : stash[index]) {
+                m->SetNext(nullptr);
+            }
+        }
+
+        for (auto op = 0; op < nops; ++op) {
+            auto index = indexes[rnd() % 3];
+            auto a = rnd() % MANAGER_N;
+            auto b = (a + 1 + rnd() % (MANAGER_N - 1)) % MANAGER_N;
+            auto& ma = models[a][index];
+            auto& mb = models[b][index];
+            switch (rnd() % 6) {
+                case 0:
+                    //  push from the stash
+                    if (!stash[index].empty()) {
+                        auto m = stash[index].back();
+                        stash[index].pop_back();
+                        lists[a].push(index, m);
+                        ma.push_back(m);
+                    }
+                    break;
+                case 1: {
+                    auto m = lists[a].pop(index);
+                    CHECK(m == (ma.empty() ? nullptr : ma.back()), "pop of 2^%d", index);
+                    if (m != nullptr) {
+                        ma.pop_back();
+                        stash[index].push_back(m);
+                    }
+                    break;
+                }
+                case 2: {
+                    //  Move pops from the head of a and appends to the tail of b
+                    size_t n = rnd() % 8;
+                    auto moved = lists[a].Move(&lists[b], index, n);
+                    CHECK(moved == std::min(n, ma.size()), "Move of 2^%d: %zu", index, moved);
+                    Model tmp(ma.end() - std::min(n, ma.size()), ma.end());
+                    ma.resize(ma.size() - tmp.size());
+                    mb.insert(mb.begin(), tmp.begin(), tmp.end());
+                    break;
+                }
+                case 3:
+                    lists[a].Swap(&lists[b], index);
+                    std::swap(ma, mb);
+                    break;
+                case 4:
+                    lists[b].Join(&lists[a]);
+                    for (auto i : indexes) {
+                        auto& sa = models[a][i];
+                        auto& sb = models[b][i];
+                        sb.insert(sb.begin(), sa.begin(), sa.end());
+                        sa.clear();
+                    }
+                    break;
+                case 5:
+                    compareOrder(lists[a], index, ma);
+                    break;
+            }
+            for (auto i = 0; i < MANAGER_N; ++i) {
+                CHECK(lists[i].Validate(0), "manager %d is broken after op %d", i, op);
+                CHECK(lists[i].GetLength(index) == models[i][index].size(), "length of manager %d", i);
+            }
+            if (failures > 0) {
+                return;
+            }
+        }
+        for (auto i = 0; i < MANAGER_N; ++i) {
+            for (auto index : indexes) {
+                compareOrder(lists[i], index, models[i][index]);
+            }
+        }
+    }
+
+    //  chunks handed between threads, freed by a thread of the next generation
+    struct Mailbox {
+        std::mutex mtx;
+        std::vector<void *> ptrs;
+        std::unordered_set<void *> live;
+    };
+
+    void fill(void *p, size_t size)
+    {
+        memset(p, (int)((uintptr_t)p >> 4), std::min(size, (size_t)64));
+    }
+
+    bool verify(void *p)
+    {
+        auto c = (unsigned char)((uintptr_t)p >> 4);
+        auto bytes = (unsigned char *)p;
+        for (auto i = 0; i < 16; ++i) {
+            if (bytes[i] != c) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    //  NOTE the thread is pinned to cpu unless it is negative
+    void worker(GlobalMemoryManager& g, int core, int cpu, int nops, uint64_t seed, Mailbox& box)
+    {
+        if (cpu >= 0) {
+            cpu_set_t mask;
+            CPU_ZERO(&mask);
+            CPU_SET(cpu, &mask);
+            sched_setaffinity(0, sizeof(mask), &mask);
+        }
+        auto lp = g.AllocLocalMemoryManager(core);
+        if (lp == nullptr) {
+            std::lock_guard<std::mutex> l(box.mtx);
+            CHECK(false, "no local memory manager for core %d", core);
+            return;
+        }
+        //  NOTE the thread is rebound if migration is enabled and sched_getcpu() differs from core
+        lp->SetOwner(&lp);
+        bench::Rand rnd(seed);
+        std::vector<void *> own;
+        for (auto op = 0; op < nops; ++op) {
+            auto r = rnd() % 4;
+            if (r < 2 || own.empty()) {
+                size_t size = 16 + rnd() % 4096;
+                auto p = lp->Malloc(size);
+                std::lock_guard<std::mutex> l(box.mtx);
+                CHECK(p != nullptr, "malloc of %zu", size);
+                CHECK(box.live.insert(p).second, "%p is allocated twice", p);
+                fill(p, size);
+                own.push_back(p);
+            }
+            else {
+                void *p = nullptr;
+                if (r == 2) {
+                    p = own.back();
+                    own.pop_back();
+                }
+                else {
+                    //  take a chunk of another thread, or hand one over
+                    std::lock_guard<std::mutex> l(box.mtx);
+                    if (!box.ptrs.empty() && rnd() % 2 == 0) {
+                        p = box.ptrs.back();
+                        box.ptrs.pop_back();
+                    }
+                    else {
+                        box.ptrs.push_back(own.back());
+                        own.pop_back();
+                    }
+                }
+                if (p != nullptr) {
+                    {
+                        std::lock_guard<std::mutex> l(box.mtx);
+                        CHECK(verify(p), "%p is overwritten", p);
+                        CHECK(box.live.erase(p) == 1, "%p is freed twice", p);
+                    }
+                    lp->Free(p);
+                }
+            }
+        }
+        {
+            std::lock_guard<std::mutex> l(box.mtx);
+            CHECK(lp->Validate(), "local memory manager of core %d is broken", lp->GetCore());
+            box.ptrs.insert(box.ptrs.end(), own.begin(), own.end());
+        }
+        lp->SetOwner(nullptr);
+        g.FreeLocalMemoryManager(lp);
+    }
+
+    //  sum of budgets of threads, which must not exceed the total
+    size_t sumBudgets(const std::vector<LocalMemoryManager *>& lps)
+    {
+        size_t sum = 0;
+        for (auto lp : lps) {
+            sum += lp->GetCacheBudget();
+        }
+        return sum;
+    }
+
+    void testBudget(uint64_t seed, int nops, int ncores)
+    {
+        MemorySizeManager msm;
+        CommonMemoryPool cmp;
+        HeapProfiler prof;
+        GlobalMemoryManager g;
+        cmp.Init(ncores, msm);
+        prof.Init();
+        g.Init(ncores, cmp, msm, prof);
+        //  NOTE not a multiple of any share
+        size_t total = 3 * CACHE_BUDGET_MIN + CACHE_BUDGET_STEP / 2;
+        g.SetCacheBudget(total);
+
+        bench::Rand rnd(seed);
+        std::vector<LocalMemoryManager *> lps;
+        const size_t managerN = ncores * g.GetPoolN();
+        for (auto op = 0; op < nops && failures == 0; ++op) {
+            switch (rnd() % 4) {
+                case 0:
+                    if (lps.size() < managerN) {
+                        //  NOTE a core of unused managers, as allocation from a full core asserts
+                        std::vector<int> used(ncores, 0);
+                        for (auto lp : lps) {
+                            ++used[lp->GetCore()];
+                        }
+                        auto core = rnd() % ncores;
+                        while (used[core] == g.GetPoolN()) {
+                            core = (core + 1) % ncores;
+                        }
+                        auto unclaimed = total - sumBudgets(lps);
+                        auto lp = g.AllocLocalMemoryManager(core);
+                        CHECK(unclaimed < CACHE_BUDGET_MIN || lp->GetCacheBudget() == CACHE_BUDGET_MIN,
+                                "thread %zu starts with %zu bytes", lps.size(), lp->GetCacheBudget());
+                        lps.push_back(lp);
+                    }
+                    break;
+                case 1:
+                    if (!lps.empty()) {
+                        auto i = rnd() % lps.size();
+                        g.FreeLocalMemoryManager(lps[i]);
+                        lps.erase(lps.begin() + i);
+                    }
+                    break;
+                case 2:
+                    if (!lps.empty()) {
+                        g.StealCacheBudget(lps[rnd() % lps.size()]);
+                    }
+                    break;
+                case 3:
+                    if (rnd() % 64 == 0) {
+                        total = CACHE_BUDGET_STEP * (1 + rnd() % 32);
+                        g.SetCacheBudget(total);
+                    }
+                    break;
+            }
+            CHECK(sumBudgets(lps) <= total, "%zu threads have %zu bytes of %zu after op %d",
+                    lps.size(), sumBudgets(lps), total, op);
+        }
+        for (auto lp : lps) {
+            g.FreeLocalMemoryManager(lp);
+        }
+        CHECK(g.Validate() && cmp.Validate(), "lists are broken at the end");
+    }
+
+    //  CPUs of the affinity mask
+    std::vector<int> usableCpus()
+    {
+        std::vector<int> cpus;
+        cpu_set_t mask;
+        if (sched_getaffinity(0, sizeof(mask), &mask) == 0) {
+            for (auto i = 0; i < CPU_SETSIZE; ++i) {
+                if (CPU_ISSET(i, &mask)) {
+                    cpus.push_back(i);
+                }
+            }
+        }
+        return cpus;
+    }
+
+    //  with cpus, thread i is pinned to cpus[i % #cpus] and starts on core ncores - 1,
+    //  which is none of them, so it is rebound to a manager of its CPU
+    void testThreads(uint64_t seed, int nthreads, int generations, int nops, int ncores, const std::vector<int>& cpus)
+    {
+        MemorySizeManager msm;
+        CommonMemoryPool cmp;
+        HeapProfiler prof;
+        GlobalMemoryManager g;
+        cmp.Init(ncores, msm);
+        prof.Init();
+        g.Init(ncores, cmp, msm, prof);
+        g.SetMigrationIntvl(cpus.empty() ? 0 : 4);
+
+        Mailbox box;
+        for (auto gen = 0; gen < generations; ++gen) {
+            std::vector<std::thread> threads;
+            for (auto i = 0; i < nthreads; ++i) {
+                auto core = cpus.empty() ? i % ncores : ncores - 1;
+                auto cpu = cpus.empty() ? -1 : cpus[i % cpus.size()];
+                threads.emplace_back(worker, std::ref(g), core, cpu, nops, seed + gen * nthreads + i, std::ref(box));
+            }
+            for (auto& th : threads) {
+                th.join();
+            }
+            CHECK(g.Validate(), "unused local memory managers are broken after generation %d", gen);
+            CHECK(cmp.Validate(), "common memory pool is broken after generation %d", gen);
+            if (failures > 0) {
+                return;
+            }
+        }
+
+        //  free the rest as a thread of core 0
+        auto lp = g.AllocLocalMemoryManager(0);
+        for (auto p : box.ptrs) {
+            CHECK(verify(p), "%p is overwritten", p);
+            lp->Free(p);
+        }
+        lp->Flush();
+        g.FreeLocalMemoryManager(lp);
+        CHECK(g.Validate() && cmp.Validate(), "lists are broken at the end");
+
+        fcm_stats stats;
+        memset(&stats, 0, sizeof(stats));
+        g.CollectStats(stats);
+        printf("%lu rebinding, %lu bytes flushed\n", (unsigned long)stats.migrations, (unsigned long)stats.migrated_bytes);
+        if (cpus.empty()) {
+            CHECK(stats.migrations == 0, "threads are rebound with migration disabled");
+        }
+        else {
+            CHECK(stats.migrations > 0, "no thread is rebound");
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    std::string test = (argc > 1) ? argv[1] : "";
+    uint64_t seed = bench::arg(argc, argv, 2, 1);
+    auto nops = bench::arg(argc, argv, 3, (test == "model") ? 100000 : 20000);
+    auto nthreads = bench::arg(argc, argv, 4, 4);
+    auto generations = bench::arg(argc, argv, 5, 8);
+    auto ncores = bench::arg(argc, argv, 6, 2);
+    std::vector<int> cpus;
+    if (test == "rebinding") {
+        cpus = usableCpus();
+        if (cpus.empty()) {
+            fprintf(stderr, "no usable CPU\n");
+            return 1;
+        }
+        //  NOTE one more core than CPUs, where threads start
+        ncores = cpus.back() + 2;
+    }
+    else if (test != "model" && test != "threads" && test != "budget") {
+        fprintf(stderr, "usage: %s <model|threads|rebinding|budget> [seed] [#ops] [#threads] [#generations] [#cores]\n", argv[0]);
+        return 1;
+    }
+    printf("stress_core %s: seed %lu, %d ops, %d threads x %d generations on %d cores\n",
+            test.c_str(), (unsigned long)seed, nops, nthreads, generations, ncores);
+    fflush(stdout);
+
+    mm.Init(ncores, sysconf(_SC_PAGESIZE), 64ul << 20, 64ul << 20);
+    mm.SetForceMmapFlag(true);
+    mm.SetReserveSize(1ul << 20);
+
+    if (test == "model") {
+        testModel(seed, nops);
+    }
+    else if (test == "budget") {
+        testBudget(seed, nops, ncores);
+    }
+    else {
+        testThreads(seed, nthreads, generations, nops, ncores, cpus);
+    }
+    printf("%s: %s\n", test.c_str(), (failures == 0) ? "ok" : "failed");
+    return (failures == 0) ? 0 : 1;
+}
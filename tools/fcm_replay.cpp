@@ -0,0 +1,228 @@
+/*
+ * Copyright 2017 Yamana Laboratory, Waseda University
+ * Supported by JST CREST Grant Number JPMJCR1503, Japan.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//  replay a trace written with FCM_TRACE_OUTPUT, and report throughput,
+//  peak RSS and fragmentation of the allocator in use
+//  usage: fcm_replay [-m] [-n] trace
+//      -m  replay each traced thread in its own thread (default: one thread in time order)
+//      -n  do not touch allocated memory
+//  e.g. LD_PRELOAD=./libfcmalloc.so ./tools/fcm_replay trace.bin
+
+#include "src/trace_format.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sched.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+    struct Op {
+        uint64_t id;    // object id, which is unique even if an address is reused
+        uint64_t size;  // 0 for free
+    };
+
+    const size_t pageSize = 4096;
+
+    bool touchFlag = true;
+    std::atomic<void *> *objs;
+    //  stored for an object whose malloc failed, so that its free is skipped
+    char failedObj;
+    std::atomic<uint64_t> failedMallocs(0);
+
+    //  read a field of /proc/self/status in KB
+    long readStatus(const char *name)
+    {
+        char buf[4096];
+        auto fd = open("/proc/self/status", O_RDONLY);
+        if (fd == -1) {
+            return -1;
+        }
+        auto len = read(fd, buf, sizeof(buf) - 1);
+        close(fd);
+        if (len <= 0) {
+            return -1;
+        }
+        buf[len] = '\0';
+        auto p = strstr(buf, name);
+        return (p == nullptr) ? -1 : atol(p + strlen(name) + 1);
+    }
+
+    //  reset VmHWM to the current RSS
+    void resetPeakRss()
+    {
+        auto fd = open("/proc/self/clear_refs", O_WRONLY);
+        if (fd != -1) {
+            write(fd, "5", 1);
+            close(fd);
+        }
+    }
+
+    void run(const Op *ops, size_t n)
+    {
+        for (auto i = 0ul; i < n; ++i) {
+            auto& op = ops[i];
+            if (op.size > 0) {
+                auto p = (char *)malloc(op.size);
+                if (p == nullptr) {
+                    failedMallocs.fetch_add(1, std::memory_order_relaxed);
+                    p = &failedObj;
+                }
+                else if (touchFlag) {
+                    for (auto off = 0ul; off < op.size; off += pageSize) {
+                        p[off] = 1;
+                    }
+                }
+                objs[op.id].store(p, std::memory_order_release);
+            }
+            else {
+                //  NOTE the object may be allocated by another thread
+                void *p;
+                while ((p = objs[op.id].load(std::memory_order_acquire)) == nullptr) {
+                    sched_yield();
+                }
+                if (p != &failedObj) {
+                    free(p);
+                }
+            }
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    auto multiFlag = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "mn")) != -1) {
+        switch (opt) {
+            case 'm': multiFlag = true; break;
+            case 'n': touchFlag = false; break;
+            default:
+                fprintf(stderr, "usage: %s [-m] [-n] trace\n", argv[0]);
+                return 1;
+        }
+    }
+    if (optind >= argc) {
+        fprintf(stderr, "usage: %s [-m] [-n] trace\n", argv[0]);
+        return 1;
+    }
+
+    auto fp = fopen(argv[optind], "rb");
+    if (fp == nullptr) {
+        perror(argv[optind]);
+        return 1;
+    }
+    TraceHeader header;
+    if (fread(&header, sizeof(header), 1, fp) != 1 || header.magic != FCM_TRACE_MAGIC
+            || header.version != FCM_TRACE_VERSION || header.recordSize != sizeof(TraceRecord)) {
+        fprintf(stderr, "%s: not a trace of this version\n", argv[optind]);
+        return 1;
+    }
+    std::vector<TraceRecord> records;
+    TraceRecord buf[4096];
+    size_t len;
+    while ((len = fread(buf, sizeof(TraceRecord), 4096, fp)) > 0) {
+        records.insert(records.end(), buf, buf + len);
+    }
+    fclose(fp);
+    std::stable_sort(records.begin(), records.end(),
+            [](const TraceRecord& a, const TraceRecord& b) { return a.time < b.time; });
+
+    //  give an id to each object, and group ops by thread if -m
+    std::unordered_map<uint64_t, uint64_t> live;
+    std::unordered_map<uint32_t, size_t> threadIndex;
+    std::vector<uint64_t> sizes;
+    std::vector<std::vector<Op>> ops;
+    uint64_t liveBytes = 0, peakLiveBytes = 0, skipped = 0;
+    for (auto& r : records) {
+        auto t = 0ul;
+        if (multiFlag) {
+            t = threadIndex.emplace(r.thread, threadIndex.size()).first->second;
+        }
+        if (t >= ops.size()) {
+            ops.resize(t + 1);
+        }
+        if (r.op == TRACE_MALLOC) {
+            auto id = sizes.size();
+            sizes.push_back(r.size);
+            live[r.ptr] = id;
+            ops[t].push_back(Op{ id, r.size == 0 ? 1 : r.size });
+            liveBytes += r.size;
+            peakLiveBytes = std::max(peakLiveBytes, liveBytes);
+        }
+        else if (r.op == TRACE_FREE) {
+            auto it = live.find(r.ptr);
+            if (it == live.end()) {
+                //  allocated before the trace started
+                ++skipped;
+                continue;
+            }
+            ops[t].push_back(Op{ it->second, 0 });
+            liveBytes -= sizes[it->second];
+            live.erase(it);
+        }
+    }
+    if (ops.empty()) {
+        ops.resize(1);
+    }
+    auto nops = records.size() - skipped;
+    objs = new std::atomic<void *>[sizes.size()]();
+    records.clear();
+    records.shrink_to_fit();
+    live.clear();
+    sizes.clear();
+    sizes.shrink_to_fit();
+
+    resetPeakRss();
+    auto baseRss = readStatus("VmRSS");
+    auto t0 = std::chrono::steady_clock::now();
+    if (multiFlag) {
+        std::vector<std::thread> threads;
+        for (auto& v : ops) {
+            threads.emplace_back(run, v.data(), v.size());
+        }
+        for (auto& th : threads) {
+            th.join();
+        }
+    }
+    else {
+        run(ops[0].data(), ops[0].size());
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    auto peakRss = readStatus("VmHWM");
+
+    auto sec = std::chrono::duration<double>(t1 - t0).count();
+    auto heapPeak = (peakRss - baseRss) * 1024.0;
+    printf("threads              : %zu\n", ops.size());
+    printf("ops                  : %zu (%lu frees of untraced memory skipped)\n", nops, (unsigned long)skipped);
+    printf("failed mallocs       : %lu\n", (unsigned long)failedMallocs.load());
+    printf("time [s]             : %.3f\n", sec);
+    printf("throughput [ops/s]   : %.0f\n", nops / sec);
+    printf("peak live [MB]       : %.1f\n", peakLiveBytes / 1048576.0);
+    printf("peak RSS [MB]        : %.1f (%.1f at start)\n", peakRss / 1024.0, baseRss / 1024.0);
+    printf("fragmentation        : %.2f (peak RSS growth / peak live)\n",
+            (peakLiveBytes > 0) ? heapPeak / peakLiveBytes : 0.0);
+    delete[] objs;
+    return 0;
+}
@@ -0,0 +1,152 @@
+/*
+ * Copyright 2017 Yamana Laboratory, Waseda University
+ * Supported by JST CREST Grant Number JPMJCR1503, Japan.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//  show live statistics of a process using libfcmalloc.so with FCM_STATS_INTVL set
+//  usage: fcmtop [-d sec] [-n count] pid
+//      -d  interval of refresh (default: 1)
+//      -n  exit after count refreshes, and print without clearing the screen
+//  e.g. FCM_STATS_INTVL=100 LD_PRELOAD=./libfcmalloc.so ./app & ./tools/fcmtop $!
+
+#include "src/stats_page.hpp"
+
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace {
+    const double oneMB = 1024.0 * 1024.0;
+
+    const StatsPage* attach(int pid)
+    {
+        char path[64];
+        snprintf(path, sizeof(path), "/dev/shm/fcmalloc.%d", pid);
+        auto fd = open(path, O_RDONLY);
+        if (fd == -1) {
+            fprintf(stderr, "cannot open %s, is FCM_STATS_INTVL set?\n", path);
+            return nullptr;
+        }
+        auto p = mmap(nullptr, sizeof(StatsPage), PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (p == MAP_FAILED) {
+            perror("mmap");
+            return nullptr;
+        }
+        auto page = (const StatsPage *)p;
+        for (auto i = 0; i < 100 && __atomic_load_n(&page->magic, __ATOMIC_ACQUIRE) != FCM_STATS_PAGE_MAGIC; ++i) {
+            usleep(10000);
+        }
+        if (page->magic != FCM_STATS_PAGE_MAGIC || page->version != FCM_STATS_PAGE_VERSION
+            || page->size != sizeof(StatsPage)) {
+            fprintf(stderr, "%s is not a stats page of version %d\n", path, FCM_STATS_PAGE_VERSION);
+            return nullptr;
+        }
+        return page;
+    }
+
+    //  rates per second between two snapshots
+    void show(const StatsPage& prev, const StatsPage& cur)
+    {
+        auto sec = (cur.time - prev.time) / 1e9;
+        if (sec <= 0) {
+            sec = 1e-9;
+        }
+        auto& s = cur.stats;
+        printf("pid %u  cores %u  threads %u  mapped %.1fMB  carved %.1fMB  live %.1fMB  cached %.1fMB  pooled %.1fMB\n",
+            cur.pid, s.num_cores, s.num_threads, s.mapped_bytes / oneMB, s.carved_bytes / oneMB,
+            s.live_bytes / oneMB, s.cached_bytes / oneMB, s.pooled_bytes / oneMB);
+        printf("migrations %lu  purged %.1fMB\n\n", (unsigned long)s.migrations, s.purged_bytes / oneMB);
+
+        printf("%6s %11s %11s %6s %11s %11s\n", "region", "mapped[MB]", "used[MB]", "used%", "cached[MB]", "pooled[MB]");
+        for (auto i = 0u; i < cur.regionN; ++i) {
+            auto& r = cur.regions[i];
+            printf("%5u%s %11.1f %11.1f %5.1f%% %11.1f %11.1f\n", i, (i + 1 == cur.regionN) ? "m" : " ",
+                r.mapped / oneMB, r.used / oneMB, (r.mapped > 0) ? 100.0 * r.used / r.mapped : 0.0,
+                r.cached / oneMB, r.pooled / oneMB);
+        }
+
+        printf("\n%8s %12s %12s %10s %10s %12s %12s %12s\n",
+            "size", "malloc/s", "free/s", "refill/s", "batch/s", "remote/s", "cached[KB]", "pooled[KB]");
+        for (auto i = 0; i < FCM_NUM_SIZES - 1; ++i) {
+            auto& c = s.sizes[i];
+            auto& p = prev.stats.sizes[i];
+            if (c.allocs == 0 && c.cached_bytes == 0 && c.pooled_bytes == 0) {
+                continue;
+            }
+            printf("%8lu %12.0f %12.0f %10.0f %10.0f %12.0f %12lu %12lu\n", 1ul << i,
+                (c.allocs - p.allocs) / sec, (c.frees - p.frees) / sec, (c.refills - p.refills) / sec,
+                (c.batches - p.batches) / sec, (c.remote_frees - p.remote_frees) / sec,
+                (unsigned long)(c.cached_bytes >> 10), (unsigned long)(c.pooled_bytes >> 10));
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    double intvl = 1.0;
+    long count = -1;
+    int opt;
+    while ((opt = getopt(argc, argv, "d:n:")) != -1) {
+        switch (opt) {
+            case 'd':
+                intvl = atof(optarg);
+                break;
+            case 'n':
+                count = atol(optarg);
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-d sec] [-n count] pid\n", argv[0]);
+                return 1;
+        }
+    }
+    if (optind >= argc) {
+        fprintf(stderr, "usage: %s [-d sec] [-n count] pid\n", argv[0]);
+        return 1;
+    }
+    auto page = attach(atoi(argv[optind]));
+    if (page == nullptr) {
+        return 1;
+    }
+
+    //  NOTE snapshots are large for the stack of main
+    static StatsPage prev, cur;
+    if (!statsPageRead(page, prev)) {
+        fprintf(stderr, "stats page is busy\n");
+        return 1;
+    }
+    for (auto i = 0; count < 0 || i < count; ++i) {
+        usleep((useconds_t)(intvl * 1e6));
+        if (!statsPageRead(page, cur)) {
+            continue;
+        }
+        if (count < 0) {
+            //  clear the screen
+            printf("\033[H\033[J");
+        }
+        show(prev, cur);
+        fflush(stdout);
+        //  NOTE the page stays after the process is killed, and then time stops
+        if (cur.time == prev.time && kill(cur.pid, 0) != 0) {
+            fprintf(stderr, "process %u has exited\n", cur.pid);
+            return 0;
+        }
+        prev = cur;
+    }
+    return 0;
+}